@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "state.h"
+
+// Opening book: deep-search results for the positions of the first few
+// cards, looked up before searching (--book, built with --build-book).
+//
+// Piles are interchangeable, so positions are keyed canonically: piles are
+// ordered by (total, cards, soft, is-last-pile) and the key hashes the state
+// in that order. Moves are stored as canonical pile slots and mapped back
+// through the looking-up position's own pile order. The pile and deck counts
+// are part of the key, so a book only answers for the variant it was built
+// for.
+struct BookEntry {
+    uint64_t key;
+    int8_t bestMove;   // canonical slot or State::kMoveUndo
+    uint8_t numMoves;
+    uint8_t moves[State::kMaxMoves]; // canonical, in root order
+    uint8_t reserved;
+    uint32_t iterations;
+    uint32_t visits[State::kMaxMoves];
+    float meanReward[State::kMaxMoves];
+    uint32_t reserved2;
+};
+static_assert(State::kPiles != 4 || sizeof(BookEntry) == 64, "BookEntry is part of the book format");
+static_assert(GAME_RULES::kClearCards <= 8, "canonicalKey() packs a pile's card count into 3 bits");
+
+static const char kBookMagic[8] = {'M', 'C', 'T', 'S', 'B', 'O', 'O', 'K'};
+static const uint32_t kBookVersion = 1;
+
+struct OpeningBook {
+    vector<BookEntry> entries; // sorted by key
+    bool loaded = false;
+
+    // Canonical key of `s`; perm[slot] is the pile of `s` in that slot.
+    static uint64_t canonicalKey(const State &s, int perm[State::kPiles]) {
+        for (int i = 0; i < State::kPiles; i++) perm[i] = i;
+        auto rank = [&](int p) {
+            return ((s.totals[p] * 8 + s.numCards[p]) * 2 + (int)s.soft[p]) * 2 + (int)(p == s.lastPos);
+        };
+        std::stable_sort(perm, perm + State::kPiles, [&](int a, int b) { return rank(a) < rank(b); });
+
+        uint64_t hash = 1469598103934665603ull;
+        auto mix = [&](int v) { hash = (hash ^ (uint64_t)(uint32_t)v) * 1099511628211ull; };
+        mix(State::kPiles);
+        mix(GAME_RULES::kDecks);
+        for (int c = 0; c < State::kPiles; c++) mix(rank(perm[c]));
+        for (int v = 0; v < 11; v++) mix(s.left[v]);
+        mix(s.cardsLeft);
+        mix(s.curCard);
+        mix(s.nextCard);
+        mix(s.nextNextCard);
+        mix(s.score);
+        mix(s.streak);
+        mix(s.canUndo);
+        mix(s.justUndid);
+        mix(s.hasBusted);
+        mix(s.prevCard);
+        mix(s.prevTotal);
+        mix(s.prevNumCards);
+        mix(s.prevScore);
+        mix(s.prevStreak);
+        mix(s.wasSoft);
+        mix(s.wasBusted);
+        mix(s.undoCounter);
+        mix(s.numUndo);
+        return hash;
+    }
+
+    // Move `move` of `s` as a canonical slot, and back.
+    static int toCanonical(int move, const int perm[State::kPiles]) {
+        if (move == State::kMoveUndo || move < 0) return move;
+        for (int c = 0; c < State::kPiles; c++) {
+            if (perm[c] == move) return c;
+        }
+        return -1;
+    }
+
+    static int fromCanonical(int slot, const int perm[State::kPiles]) {
+        if (slot == State::kMoveUndo || slot < 0 || slot >= State::kPiles) return slot;
+        return perm[slot];
+    }
+
+    const BookEntry *find(uint64_t key) const {
+        auto it = std::lower_bound(entries.begin(), entries.end(), key,
+                                   [](const BookEntry &e, uint64_t k) { return e.key < k; });
+        return (it != entries.end() && it->key == key) ? &*it : NULL;
+    }
+
+    // Book move for `s` (a pile of `s` or kMoveUndo), or -1 if it is not in
+    // the book or the stored move is not legal here.
+    int lookup(const State &s) const {
+        if (entries.empty()) return -1;
+        int perm[State::kPiles];
+        const BookEntry *entry = find(canonicalKey(s, perm));
+        if (entry == NULL) return -1;
+        const int move = fromCanonical(entry->bestMove, perm);
+        uint8_t moves[State::kMaxMoves];
+        const int count = s.generateMoves(moves);
+        for (int i = 0; i < count; i++) {
+            if (moves[i] == move) return move;
+        }
+        return -1;
+    }
+
+    bool load(const std::string &path) {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == NULL) return false;
+        char magic[8];
+        uint32_t version = 0, entrySize = 0;
+        uint64_t count = 0;
+        bool ok = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, kBookMagic, sizeof(magic)) == 0
+            && fread(&version, sizeof(version), 1, file) == 1 && version == kBookVersion
+            && fread(&entrySize, sizeof(entrySize), 1, file) == 1 && entrySize == sizeof(BookEntry)
+            && fread(&count, sizeof(count), 1, file) == 1;
+        if (ok) {
+            entries.resize((size_t)count);
+            ok = fread(entries.data(), sizeof(BookEntry), entries.size(), file) == entries.size();
+        }
+        fclose(file);
+        if (!ok) {
+            entries.clear();
+            return false;
+        }
+        std::sort(entries.begin(), entries.end(), [](const BookEntry &a, const BookEntry &b) { return a.key < b.key; });
+        loaded = true;
+        return true;
+    }
+
+    bool save(const std::string &path) {
+        std::sort(entries.begin(), entries.end(), [](const BookEntry &a, const BookEntry &b) { return a.key < b.key; });
+        FILE *file = fopen(path.c_str(), "wb");
+        if (file == NULL) return false;
+        const uint32_t version = kBookVersion, entrySize = sizeof(BookEntry);
+        const uint64_t count = entries.size();
+        bool ok = fwrite(kBookMagic, sizeof(kBookMagic), 1, file) == 1
+            && fwrite(&version, sizeof(version), 1, file) == 1
+            && fwrite(&entrySize, sizeof(entrySize), 1, file) == 1
+            && fwrite(&count, sizeof(count), 1, file) == 1
+            && fwrite(entries.data(), sizeof(BookEntry), entries.size(), file) == entries.size();
+        fclose(file);
+        return ok;
+    }
+
+    static OpeningBook &active() {
+        static OpeningBook book;
+        return book;
+    }
+};
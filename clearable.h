@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "rules.h"
+
+// Pile clearability tables: for a pile (total, cards, soft) and a coarse
+// profile of the cards still to come, the probability that the pile clears,
+// and that it busts, within the next k cards put on it (k = 1..kHorizon).
+// makeSmartMove() adds the kPolicyCards entries of the piles a move leaves to
+// its one-step clear count when a table is loaded with --clearable <file>
+// (build one with --calc-clearable [file]).
+//
+// The profile buckets the share of the remaining cards that are wild, aces
+// and tens, and how the rest splits between 2-5 and 6-9. Tables are computed
+// for the bucket's representative deck, drawing with replacement.
+struct ClearTable {
+    static constexpr int kHorizon = 3;
+    static constexpr int kPolicyCards = 2;
+    static constexpr int kTotals = 22;
+    static constexpr int kCards = GAME_RULES::kClearCards;
+    static constexpr int kWildLevels = 3;
+    static constexpr int kAceLevels = 4;
+    static constexpr int kTenLevels = 6;
+    static constexpr int kLowLevels = 5;
+    static constexpr int kProfiles = kWildLevels * kAceLevels * kTenLevels * kLowLevels;
+
+    struct Entry {
+        float clear[kHorizon]; // [k]: within k + 1 cards
+        float bust[kHorizon];
+    };
+
+    std::vector<Entry> entries;
+    bool loaded = false;
+
+    // Profile of a deck with `left` cards of each value, `cardsLeft` in all.
+    static int profile(const int left[11], int cardsLeft) {
+        if (cardsLeft <= 0) return 0;
+        const double inv = 1.0 / (double)cardsLeft;
+        const double wild = left[0] * inv;
+        const double ace = left[1] * inv;
+        const double ten = left[10] * inv;
+        const int low = left[2] + left[3] + left[4] + left[5];
+        const int mid = left[6] + left[7] + left[8] + left[9];
+        const double lowShare = low + mid > 0 ? (double)low / (double)(low + mid) : 0.5;
+
+        const int w = left[0] == 0 ? 0 : wild < 0.05 ? 1 : 2;
+        const int a = left[1] == 0 ? 0 : ace < 0.06 ? 1 : ace < 0.10 ? 2 : 3;
+        const int t = ten < 0.15 ? 0 : ten < 0.22 ? 1 : ten < 0.29 ? 2 : ten < 0.36 ? 3 : ten < 0.45 ? 4 : 5;
+        const int l = lowShare < 0.30 ? 0 : lowShare < 0.43 ? 1 : lowShare < 0.57 ? 2 : lowShare < 0.70 ? 3 : 4;
+        return ((w * kAceLevels + a) * kTenLevels + t) * kLowLevels + l;
+    }
+
+    static size_t index(int profile, int total, int numCards, bool soft) {
+        return (((size_t)profile * kTotals + (size_t)total) * kCards + (size_t)numCards) * 2 + (soft ? 1 : 0);
+    }
+
+    // Entry for a pile that has not cleared (total <= 21, numCards < kCards).
+    const Entry &at(int profile, int total, int numCards, bool soft) const {
+        return entries[index(profile, total, numCards, soft)];
+    }
+
+    // Card value probabilities of a profile's representative deck.
+    static void representativeDeck(int profile, double p[11]) {
+        static const double kWild[kWildLevels] = {0.0, 0.03, 0.08};
+        static const double kAce[kAceLevels] = {0.0, 0.04, 0.08, 0.13};
+        static const double kTen[kTenLevels] = {0.10, 0.19, 0.26, 0.33, 0.40, 0.52};
+        static const double kLow[kLowLevels] = {0.20, 0.37, 0.50, 0.63, 0.80};
+        const int l = profile % kLowLevels;
+        const int t = (profile / kLowLevels) % kTenLevels;
+        const int a = (profile / (kLowLevels * kTenLevels)) % kAceLevels;
+        const int w = profile / (kLowLevels * kTenLevels * kAceLevels);
+        p[0] = kWild[w];
+        p[1] = kAce[a];
+        p[10] = kTen[t];
+        const double rest = std::max(0.0, 1.0 - p[0] - p[1] - p[10]);
+        for (int v = 2; v <= 5; v++) p[v] = rest * kLow[l] / 4.0;
+        for (int v = 6; v <= 9; v++) p[v] = rest * (1.0 - kLow[l]) / 4.0;
+        double sum = 0.0;
+        for (int v = 0; v <= 10; v++) sum += p[v];
+        for (int v = 0; v <= 10; v++) p[v] /= sum;
+    }
+
+    // Probabilities that the pile clears / busts within `k` cards drawn from
+    // `p`, following the placement rules of State::nextState().
+    static void pileOutcome(const double p[11], int total, int numCards, bool soft, int k,
+                            double &clear, double &bust) {
+        clear = 0.0;
+        bust = 0.0;
+        if (k <= 0) return;
+        clear += p[0]; // a wild clears any pile
+        for (int v = 1; v <= 10; v++) {
+            if (p[v] <= 0.0) continue;
+            const int newTotal = total + v;
+            const int newNum = numCards + 1;
+            bool newSoft = soft;
+            if (newTotal <= 11 && v == 1) newSoft = true;
+            if (newTotal > 11) newSoft = false;
+            if (newTotal > 21) {
+                bust += p[v];
+            } else if (newTotal == 21 || (newTotal == 11 && newSoft) || newNum >= kCards) {
+                clear += p[v];
+            } else {
+                double c, b;
+                pileOutcome(p, newTotal, newNum, newSoft, k - 1, c, b);
+                clear += p[v] * c;
+                bust += p[v] * b;
+            }
+        }
+    }
+
+    void calc() {
+        entries.assign((size_t)kProfiles * kTotals * kCards * 2, Entry());
+        for (int profile = 0; profile < kProfiles; profile++) {
+            double p[11];
+            representativeDeck(profile, p);
+            for (int total = 0; total < kTotals; total++) {
+                for (int n = 0; n < kCards; n++) {
+                    for (int soft = 0; soft < 2; soft++) {
+                        Entry &entry = entries[index(profile, total, n, soft != 0)];
+                        for (int k = 0; k < kHorizon; k++) {
+                            double c, b;
+                            pileOutcome(p, total, n, soft != 0, k + 1, c, b);
+                            entry.clear[k] = (float)c;
+                            entry.bust[k] = (float)b;
+                        }
+                    }
+                }
+            }
+        }
+        loaded = true;
+    }
+
+    bool read(const std::string &path) {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == NULL) return false;
+        uint32_t header[4];
+        const size_t count = (size_t)kProfiles * kTotals * kCards * 2;
+        bool ok = fread(header, sizeof(header), 1, file) == 1
+            && memcmp(header, kMagic, sizeof(kMagic)) == 0
+            && header[2] == (uint32_t)kCards && header[3] == (uint32_t)count;
+        if (ok) {
+            entries.resize(count);
+            ok = fread(entries.data(), sizeof(Entry), count, file) == count;
+        }
+        fclose(file);
+        if (!ok) {
+            entries.clear();
+            return false;
+        }
+        loaded = true;
+        return true;
+    }
+
+    bool write(const std::string &path) const {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (file == NULL) return false;
+        uint32_t header[4] = {0, 0, (uint32_t)kCards, (uint32_t)entries.size()};
+        memcpy(header, kMagic, sizeof(kMagic));
+        bool ok = fwrite(header, sizeof(header), 1, file) == 1
+            && fwrite(entries.data(), sizeof(Entry), entries.size(), file) == entries.size();
+        fclose(file);
+        return ok;
+    }
+
+    static ClearTable &active() {
+        static ClearTable table;
+        return table;
+    }
+
+private:
+    static constexpr char kMagic[8] = {'C', 'L', 'E', 'A', 'R', 'T', 'B', '1'};
+};
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "state.h"
+
+// Self-play dataset: one fixed-size record per searched decision, written to
+// append-only chunk files that can be memory-mapped and read in place.
+//
+// A chunk file is a 32-byte DatasetHeader followed by SelfPlayRecords; the
+// record count is (file size - header) / recordSize, so a chunk never needs
+// rewriting and a partly written chunk is still readable up to its last
+// whole record.
+
+// Every State field, narrowed. Round-trips exactly through pack()/unpack().
+struct PackedState {
+    int16_t score;
+    int16_t prevScore;
+    int8_t totals[State::kPiles];
+    int8_t numCards[State::kPiles];
+    int8_t left[11];
+    int8_t cardsLeft;
+    int8_t curCard;
+    int8_t streak;
+    int8_t nextCard;
+    int8_t nextNextCard;
+    int8_t prevCard;
+    int8_t prevStreak;
+    int8_t lastPos;
+    int8_t prevTotal;
+    int8_t prevNumCards;
+    int8_t undoCounter;
+    int8_t numUndo;
+    int8_t curMove;
+    int8_t curSuit;
+    int8_t curRank;
+    uint8_t softMask; // bit i: soft[i]
+    uint8_t flags;    // canUndo, justUndid, wasSoft, wasBusted, hasBusted
+    uint8_t reserved[8];
+
+    static PackedState pack(const State &s) {
+        PackedState p;
+        memset(&p, 0, sizeof(p));
+        p.score = (int16_t)s.score;
+        p.prevScore = (int16_t)s.prevScore;
+        for (int i = 0; i < State::kPiles; i++) {
+            p.totals[i] = (int8_t)s.totals[i];
+            p.numCards[i] = (int8_t)s.numCards[i];
+            p.softMask |= (uint8_t)(s.soft[i] ? 1 << i : 0);
+        }
+        for (int i = 0; i < 11; i++) p.left[i] = (int8_t)s.left[i];
+        p.cardsLeft = (int8_t)s.cardsLeft;
+        p.curCard = (int8_t)s.curCard;
+        p.streak = (int8_t)s.streak;
+        p.nextCard = (int8_t)s.nextCard;
+        p.nextNextCard = (int8_t)s.nextNextCard;
+        p.prevCard = (int8_t)s.prevCard;
+        p.prevStreak = (int8_t)s.prevStreak;
+        p.lastPos = (int8_t)s.lastPos;
+        p.prevTotal = (int8_t)s.prevTotal;
+        p.prevNumCards = (int8_t)s.prevNumCards;
+        p.undoCounter = (int8_t)s.undoCounter;
+        p.numUndo = (int8_t)s.numUndo;
+        p.curMove = (int8_t)s.curMove;
+        p.curSuit = (int8_t)s.curSuit;
+        p.curRank = (int8_t)s.curRank;
+        p.flags = (uint8_t)((s.canUndo ? 1 : 0) | (s.justUndid ? 2 : 0) | (s.wasSoft ? 4 : 0)
+                            | (s.wasBusted ? 8 : 0) | (s.hasBusted ? 16 : 0));
+        return p;
+    }
+
+    void unpack(State &s) const {
+        s.score = score;
+        s.prevScore = prevScore;
+        for (int i = 0; i < State::kPiles; i++) {
+            s.totals[i] = totals[i];
+            s.numCards[i] = numCards[i];
+            s.soft[i] = (softMask >> i) & 1;
+        }
+        for (int i = 0; i < 11; i++) s.left[i] = left[i];
+        s.cardsLeft = cardsLeft;
+        s.curCard = curCard;
+        s.streak = streak;
+        s.nextCard = nextCard;
+        s.nextNextCard = nextNextCard;
+        s.prevCard = prevCard;
+        s.prevStreak = prevStreak;
+        s.lastPos = lastPos;
+        s.prevTotal = prevTotal;
+        s.prevNumCards = prevNumCards;
+        s.undoCounter = undoCounter;
+        s.numUndo = numUndo;
+        s.curMove = curMove;
+        s.curSuit = curSuit;
+        s.curRank = curRank;
+        s.canUndo = flags & 1;
+        s.justUndid = (flags >> 1) & 1;
+        s.wasSoft = (flags >> 2) & 1;
+        s.wasBusted = (flags >> 3) & 1;
+        s.hasBusted = (flags >> 4) & 1;
+    }
+};
+static_assert(State::kPiles != 4 || sizeof(PackedState) == 48, "PackedState is part of the dataset format");
+static_assert(GAME_RULES::kDeckSize <= INT8_MAX, "PackedState::cardsLeft and left[] are int8_t");
+static_assert(State::kPiles <= 8, "PackedState::softMask has one bit per pile");
+
+// One searched decision. Root children are listed in tree order; rewards are
+// in the search's normalised units. Forced moves are not searched and are not
+// recorded, so every record has at least two moves and some visits.
+struct SelfPlayRecord {
+    PackedState state;
+    uint32_t game;
+    uint16_t ply;
+    int16_t finalScore; // score - numUndo / 5 at the end of the game
+    uint8_t numMoves;
+    int8_t chosenMove;  // pile, State::kMoveUndo, or -1
+    uint8_t moves[State::kMaxMoves];
+    uint8_t reserved;
+    uint32_t visits[State::kMaxMoves];
+    float meanReward[State::kMaxMoves];
+};
+static_assert(State::kPiles != 4 || sizeof(SelfPlayRecord) == 104, "SelfPlayRecord is part of the dataset format");
+
+struct DatasetHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint8_t piles;   // rules the records were played under
+    uint8_t decks;
+    uint8_t reserved[14];
+};
+static_assert(sizeof(DatasetHeader) == 32, "DatasetHeader is part of the dataset format");
+
+static const char kDatasetMagic[8] = {'M', 'C', 'T', 'S', 'S', 'P', 'D', '\0'};
+static const uint32_t kDatasetVersion = 2;
+
+// Buffers one writer's records in memory and appends them to its own chunk
+// files, so parallel generators never share a file or a lock. A game's
+// records are held back until endGame() fills in the final score. Chunks are
+// named by run id, writer and number and are created exclusively: a name
+// that is already taken is skipped, never truncated.
+class DatasetWriter {
+public:
+    static constexpr size_t kFlushRecords = 4096;
+    static constexpr size_t kRecordsPerChunk = 1 << 20;
+
+    DatasetWriter(const std::string &dir, int writerId, uint64_t runId) : dir(dir), writerId(writerId), runId(runId) {
+        buffer.reserve(kFlushRecords);
+    }
+
+    ~DatasetWriter() {
+        flush();
+        if (file != NULL) fclose(file);
+    }
+
+    DatasetWriter(const DatasetWriter &) = delete;
+    DatasetWriter &operator=(const DatasetWriter &) = delete;
+
+    void add(const SelfPlayRecord &record) {
+        game.push_back(record);
+    }
+
+    void endGame(int finalScore) {
+        for (SelfPlayRecord &record : game) {
+            record.finalScore = (int16_t)finalScore;
+            buffer.push_back(record);
+        }
+        game.clear();
+        if (buffer.size() >= kFlushRecords) flush();
+    }
+
+    bool flush() {
+        size_t done = 0;
+        while (done < buffer.size()) {
+            if (file == NULL || inChunk >= kRecordsPerChunk) {
+                if (!openChunk()) return false;
+            }
+            const size_t n = std::min(buffer.size() - done, kRecordsPerChunk - inChunk);
+            if (fwrite(buffer.data() + done, sizeof(SelfPlayRecord), n, file) != n) {
+                std::cerr << "Dataset write failed" << std::endl;
+                return false;
+            }
+            inChunk += n;
+            written += n;
+            done += n;
+        }
+        buffer.clear();
+        if (file != NULL) fflush(file);
+        return true;
+    }
+
+    size_t recordsWritten() const { return written; }
+
+private:
+    bool openChunk() {
+        if (file != NULL) fclose(file);
+        file = NULL;
+        while (file == NULL) {
+            char name[96];
+            snprintf(name, sizeof(name), "/selfplay-%016llx-w%02d-%04d.bin", (unsigned long long)runId, writerId, chunk++);
+            const std::string path = dir + name;
+            file = fopen(path.c_str(), "wbx");
+            if (file == NULL && errno != EEXIST) {
+                std::cerr << "Could not create dataset chunk " << path << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+        }
+        DatasetHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kDatasetMagic, sizeof(header.magic));
+        header.version = kDatasetVersion;
+        header.recordSize = sizeof(SelfPlayRecord);
+        header.piles = (uint8_t)State::kPiles;
+        header.decks = (uint8_t)GAME_RULES::kDecks;
+        fwrite(&header, sizeof(header), 1, file);
+        inChunk = 0;
+        return true;
+    }
+
+    std::string dir;
+    int writerId;
+    uint64_t runId;
+    int chunk = 0;
+    FILE *file = NULL;
+    size_t inChunk = 0;
+    size_t written = 0;
+    std::vector<SelfPlayRecord> game;
+    std::vector<SelfPlayRecord> buffer;
+};
+
+// Read-only memory map of one chunk file.
+struct DatasetView {
+    const SelfPlayRecord *records = NULL;
+    size_t count = 0;
+
+    ~DatasetView() { close(); }
+
+    bool open(const std::string &path) {
+        close();
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DatasetHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void *mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) return false;
+        const DatasetHeader *header = (const DatasetHeader *)mapped;
+        if (memcmp(header->magic, kDatasetMagic, sizeof(kDatasetMagic)) != 0
+            || header->version != kDatasetVersion || header->recordSize != sizeof(SelfPlayRecord)
+            || header->piles != State::kPiles || header->decks != GAME_RULES::kDecks) {
+            munmap(mapped, (size_t)st.st_size);
+            return false;
+        }
+        base = mapped;
+        size = (size_t)st.st_size;
+        records = (const SelfPlayRecord *)((const uint8_t *)mapped + sizeof(DatasetHeader));
+        count = (size - sizeof(DatasetHeader)) / sizeof(SelfPlayRecord);
+        return true;
+    }
+
+    void close() {
+        if (base != NULL) munmap(base, size);
+        base = NULL;
+        size = 0;
+        records = NULL;
+        count = 0;
+    }
+
+private:
+    void *base = NULL;
+    size_t size = 0;
+};
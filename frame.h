@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Card region of interest in reference (714x1056) coordinates. It covers every
+// probe read by State::fromFrame() with a few pixels of margin.
+static constexpr int kCardRoiLeft = 380;
+static constexpr int kCardRoiTop = 736;
+static constexpr int kCardRoiRight = 490;
+static constexpr int kCardRoiBottom = 852;
+
+// A BGRA, top-down pixel window onto a captured image. Usually this is just the
+// card region of interest copied into `storage`, which is kept across frames so
+// steady-state captures do not allocate. A frame can also be a view over a
+// caller-owned full image (see view()).
+struct Frame {
+    std::vector<uint8_t> storage;
+    const uint8_t *data = nullptr;
+    int stride = 0; // bytes per row of `data`
+    int bpp = 4;
+
+    // Region covered by `data`, in source-image pixels.
+    int originX = 0;
+    int originY = 0;
+    int width = 0;
+    int height = 0;
+
+    // Size of the whole source image; reference coordinates scale into this.
+    int sourceWidth = 0;
+    int sourceHeight = 0;
+
+    static Frame view(const uint8_t *pixels, int width, int height, int bpp) {
+        Frame frame;
+        frame.data = pixels;
+        frame.stride = width * bpp;
+        frame.bpp = bpp;
+        frame.width = width;
+        frame.height = height;
+        frame.sourceWidth = width;
+        frame.sourceHeight = height;
+        return frame;
+    }
+
+    // Sizes `storage` for a region of (w x h) and points `data` at it. The
+    // buffer only grows, so repeated captures of the same window reuse it.
+    uint8_t *prepare(int srcWidth, int srcHeight, int x0, int y0, int w, int h) {
+        sourceWidth = srcWidth;
+        sourceHeight = srcHeight;
+        originX = x0;
+        originY = y0;
+        width = w > 0 ? w : 0;
+        height = h > 0 ? h : 0;
+        bpp = 4;
+        stride = width * bpp;
+        const size_t bytes = (size_t)stride * (size_t)height;
+        if (storage.size() < bytes) storage.resize(bytes);
+        data = storage.data();
+        return storage.data();
+    }
+
+    // Copies the region [x0,x1) x [y0,y1) out of a full BGRA image.
+    bool cropFrom(const uint8_t *src, int srcWidth, int srcHeight, size_t srcStride,
+                  int x0, int y0, int x1, int y1) {
+        if (x0 < 0) x0 = 0;
+        if (y0 < 0) y0 = 0;
+        if (x1 > srcWidth) x1 = srcWidth;
+        if (y1 > srcHeight) y1 = srcHeight;
+        if (src == nullptr || x1 <= x0 || y1 <= y0) {
+            prepare(srcWidth, srcHeight, 0, 0, 0, 0);
+            return false;
+        }
+        uint8_t *dst = prepare(srcWidth, srcHeight, x0, y0, x1 - x0, y1 - y0);
+        for (int y = 0; y < height; y++) {
+            memcpy(dst + (size_t)y * stride, src + (size_t)(y0 + y) * srcStride + (size_t)x0 * 4, (size_t)stride);
+        }
+        return true;
+    }
+
+    // Cheap content hash of the region: every kFingerprintStep-th pixel on
+    // every kFingerprintStep-th row, with the low bits of each channel masked
+    // off so that capture noise does not register as a change.
+    static constexpr int kFingerprintStep = 4;
+
+    uint64_t fingerprint() const {
+        uint64_t hash = 1469598103934665603ull;
+        if (data == nullptr) return hash;
+        for (int y = 0; y < height; y += kFingerprintStep) {
+            const uint8_t *row = data + (size_t)y * stride;
+            for (int x = 0; x < width; x += kFingerprintStep) {
+                uint32_t word;
+                memcpy(&word, row + (size_t)x * bpp, sizeof(word));
+                hash = (hash ^ (word & 0x00F0F0F0u)) * 1099511628211ull;
+            }
+        }
+        return hash ^ ((uint64_t)width << 32) ^ (uint64_t)height;
+    }
+
+    // Pointer to source pixel (px,py), or nullptr if it is outside the region.
+    inline const uint8_t *pixel(int px, int py) const {
+        px -= originX;
+        py -= originY;
+        if (px < 0 || py < 0 || px >= width || py >= height || data == nullptr) {
+            return nullptr;
+        }
+        return data + (size_t)py * stride + (size_t)px * bpp;
+    }
+};
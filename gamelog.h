@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Append-only log of live games: every detected card, the search that
+// followed it and the move shown. A 16-byte header is followed by fixed-size
+// entries; a new game starts with a kGameStart entry. Each search is run
+// right after reseeding the card RNG with the logged seed, so --replay can
+// repeat it exactly from the log alone, given the same weights, value
+// function, clearability table and book; kGameStart records a hash of those.
+struct GameLogEntry {
+    static constexpr uint8_t kGameStart = 1;
+    static constexpr uint8_t kCard = 2;
+
+    // Search settings that change the chosen move, in `flags`.
+    static constexpr uint32_t kSequentialHalving = 1;
+
+    uint8_t kind;
+    int8_t rank;        // detected card, kCard only
+    int8_t suit;
+    int8_t chosenMove;  // pile, State::kMoveUndo, or -1 when no search ran
+    uint32_t iterations;
+    uint64_t seed;
+    int64_t detectedAtUs; // wall clock, microseconds since the epoch
+    uint32_t searchUs;
+    int32_t rolloutDepth;
+    int64_t maxTreeNodes;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t setup;       // kGameStart only: hash of the loaded tables (setupHash() in mcts.cpp)
+};
+static_assert(sizeof(GameLogEntry) == 56, "GameLogEntry is part of the log format");
+
+static const char kGameLogMagic[8] = {'M', 'C', 'T', 'S', 'L', 'O', 'G', '\0'};
+static const uint32_t kGameLogVersion = 3;
+
+// FNV-1a over `size` bytes, continuing from `hash`.
+static inline uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+static inline int64_t wallClockUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+class GameLogWriter {
+public:
+    // Appends to `path`; false if it holds a log of another version.
+    bool open(const std::string &path) {
+        file = fopen(path.c_str(), "a+b");
+        if (file == NULL) return false;
+        fseek(file, 0, SEEK_END);
+        if (ftell(file) != 0) {
+            uint32_t header[4];
+            fseek(file, 0, SEEK_SET);
+            const bool same = fread(header, sizeof(header), 1, file) == 1
+                && memcmp(header, kGameLogMagic, sizeof(kGameLogMagic)) == 0
+                && header[2] == kGameLogVersion && header[3] == sizeof(GameLogEntry);
+            fseek(file, 0, SEEK_END);
+            if (!same) {
+                fclose(file);
+                file = NULL;
+                return false;
+            }
+        } else {
+            uint32_t header[4] = {0, 0, kGameLogVersion, (uint32_t)sizeof(GameLogEntry)};
+            memcpy(header, kGameLogMagic, sizeof(kGameLogMagic));
+            fwrite(header, sizeof(header), 1, file);
+        }
+        return true;
+    }
+
+    ~GameLogWriter() {
+        if (file != NULL) fclose(file);
+    }
+
+    // Entries are flushed one by one so that a crash keeps the game so far.
+    void write(const GameLogEntry &entry) {
+        if (file == NULL) return;
+        fwrite(&entry, sizeof(entry), 1, file);
+        fflush(file);
+    }
+
+private:
+    FILE *file = NULL;
+};
+
+static bool readGameLog(const std::string &path, std::vector<GameLogEntry> &entries) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL) return false;
+    uint32_t header[4];
+    bool ok = fread(header, sizeof(header), 1, file) == 1
+        && memcmp(header, kGameLogMagic, sizeof(kGameLogMagic)) == 0
+        && header[2] == kGameLogVersion && header[3] == sizeof(GameLogEntry);
+    GameLogEntry entry;
+    while (ok && fread(&entry, sizeof(entry), 1, file) == 1) {
+        entries.push_back(entry);
+    }
+    fclose(file);
+    return ok;
+}
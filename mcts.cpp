@@ -10,17 +10,39 @@
 #include <execution>
 #include <algorithm>
 #include <mutex>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#ifdef __APPLE__
 #include <ApplicationServices/ApplicationServices.h>
 #include <ImageIO/ImageIO.h>
 #include <CoreServices/CoreServices.h>
+#else
+#include <png.h>
+#endif
 #include <cstdint>
+#include <atomic>
+#include <climits>
+#include <sys/resource.h>
+#include "frame.h"
 #include "state.h"
 #include "overlay.h"
+#include "tune.h"
+#include "value.h"
+#include "dataset.h"
+#include "gamelog.h"
+#include "book.h"
+#include "pool.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "recognition_train.h"
+#include "budget.h"
 
 #define NUM_THREADS 1
 
 using namespace std;
 
+#ifdef __APPLE__
 struct WindowMatchInfo {
     CGWindowID windowId = 0;
     std::string needle;
@@ -280,49 +302,152 @@ static bool loadImageFileToBGRA(const std::string &path, std::vector<uint8_t> &o
     return true;
 }
 
-static bool copyCGImageToBGRA(CGImageRef image, std::vector<uint8_t> &outPixels, int &outWidth, int &outHeight) {
-    outPixels.clear();
-    outWidth = 0;
-    outHeight = 0;
+// Converts only the card region of interest of a captured window image into
+// `frame`, reusing the frame's buffer. The crop itself does not copy pixels.
+static bool copyCGImageRegionToFrame(CGImageRef image, Frame &frame) {
     if (image == nullptr) return false;
 
     const size_t w = CGImageGetWidth(image);
     const size_t h = CGImageGetHeight(image);
     if (w == 0 || h == 0) return false;
 
-    const size_t bytesPerRow = w * 4;
-    outPixels.resize(bytesPerRow * h);
+    int x0, y0, x1, y1;
+    State::cardRegion((int)w, (int)h, x0, y0, x1, y1);
+    x0 = max(x0, 0);
+    y0 = max(y0, 0);
+    x1 = min(x1, (int)w);
+    y1 = min(y1, (int)h);
+    if (x1 <= x0 || y1 <= y0) return false;
 
-    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGImageRef region = CGImageCreateWithImageInRect(image, CGRectMake(x0, y0, x1 - x0, y1 - y0));
+    if (region == nullptr) return false;
+
+    static CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
     if (colorSpace == nullptr) {
-        outPixels.clear();
+        CGImageRelease(region);
         return false;
     }
 
+    uint8_t *dst = frame.prepare((int)w, (int)h, x0, y0, x1 - x0, y1 - y0);
     const CGBitmapInfo bitmapInfo = (CGBitmapInfo)(kCGBitmapByteOrder32Little | kCGImageAlphaPremultipliedFirst);
     CGContextRef ctx = CGBitmapContextCreate(
-        outPixels.data(),
-        w,
-        h,
+        dst,
+        (size_t)frame.width,
+        (size_t)frame.height,
         8,
-        bytesPerRow,
+        (size_t)frame.stride,
         colorSpace,
         bitmapInfo
     );
-    CGColorSpaceRelease(colorSpace);
     if (ctx == nullptr) {
-        outPixels.clear();
+        CGImageRelease(region);
         return false;
     }
 
     // Match the pixel layout produced by loadImageFileToBGRA().
-    CGContextDrawImage(ctx, CGRectMake(0, 0, (CGFloat)w, (CGFloat)h), image);
+    CGContextDrawImage(ctx, CGRectMake(0, 0, (CGFloat)frame.width, (CGFloat)frame.height), region);
     CGContextRelease(ctx);
+    CGImageRelease(region);
+    return true;
+}
+#else
+static bool loadImageFileToBGRA(const std::string &path, std::vector<uint8_t> &outPixels, int &outWidth, int &outHeight) {
+    outPixels.clear();
+    outWidth = 0;
+    outHeight = 0;
 
-    outWidth = (int)w;
-    outHeight = (int)h;
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path.c_str())) return false;
+
+    image.format = PNG_FORMAT_BGRA;
+    outPixels.resize(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, nullptr, outPixels.data(), 0, nullptr)) {
+        png_image_free(&image);
+        outPixels.clear();
+        return false;
+    }
+
+    outWidth = (int)image.width;
+    outHeight = (int)image.height;
     return true;
 }
+#endif
+
+// Loads an image file and keeps only its card region of interest in `frame`.
+static bool loadFrameFromImageFile(const std::string &path, Frame &frame) {
+    std::vector<uint8_t> pixels;
+    int width = 0;
+    int height = 0;
+    if (!loadImageFileToBGRA(path, pixels, width, height)) return false;
+
+    int x0, y0, x1, y1;
+    State::cardRegion(width, height, x0, y0, x1, y1);
+    return frame.cropFrom(pixels.data(), width, height, (size_t)width * 4, x0, y0, x1, y1);
+}
+
+// Parses the card a corpus image shows from its name, e.g. "test8d.png" or
+// "testah.png": rank character (a,2-9,t,j,q,k) then suit (h,d,c,s).
+static bool parseCardLabel(const std::string &fileName, int &rank, int &suit) {
+    const std::string prefix = "test";
+    if (fileName.size() < prefix.size() + 2 || fileName.compare(0, prefix.size(), prefix) != 0) return false;
+    const char rankChar = (char)std::tolower(fileName[prefix.size()]);
+    const char suitChar = (char)std::tolower(fileName[prefix.size() + 1]);
+
+    const std::string ranks = "a23456789tjqk";
+    const std::string suits = "hdcs";
+    const size_t r = ranks.find(rankChar);
+    const size_t s = suits.find(suitChar);
+    if (r == std::string::npos || s == std::string::npos) return false;
+    rank = (int)r;
+    suit = (int)s;
+    return true;
+}
+
+// Replayed frames: image files held in memory and delivered in order,
+// `repeat` captures each (so ambiguous readings can be confirmed), `passes`
+// times over. Only the card region is converted per capture, as live.
+class ImageReplaySource : public FrameSource {
+public:
+    ImageReplaySource(int repeat, int passes) : repeat(max(1, repeat)), passes(max(1, passes)) {}
+
+    bool add(const std::string &path) {
+        Image image;
+        if (!loadImageFileToBGRA(path, image.pixels, image.width, image.height)) return false;
+        images.push_back(std::move(image));
+        return true;
+    }
+
+    size_t size() const { return images.size(); }
+
+    bool next(Frame &frame, FrameMeta &meta) override {
+        if (images.empty() || position >= images.size() * repeat * passes) return false;
+        const Image &image = images[(position / repeat) % images.size()];
+        position++;
+        meta.captureStartUs = monotonicUs();
+        meta.captureEndUs = meta.captureStartUs; // already in memory
+        int x0, y0, x1, y1;
+        State::cardRegion(image.width, image.height, x0, y0, x1, y1);
+        frame.cropFrom(image.pixels.data(), image.width, image.height, (size_t)image.width * 4, x0, y0, x1, y1);
+        meta.convertEndUs = monotonicUs();
+        meta.windowW = image.width;
+        meta.windowH = image.height;
+        return true;
+    }
+
+private:
+    struct Image {
+        std::vector<uint8_t> pixels;
+        int width = 0;
+        int height = 0;
+    };
+
+    std::vector<Image> images;
+    int repeat;
+    int passes;
+    size_t position = 0;
+};
 
 static int fromPixelsTest(const std::string &inputPath) {
     std::vector<uint8_t> pixels;
@@ -337,6 +462,7 @@ static int fromPixelsTest(const std::string &inputPath) {
     // `fromPixels()` uses hardcoded *screen-space pixel coordinates*.
     // If the test image is a window-only screenshot, we need a transform that
     // maps screen-space into this buffer.
+#ifdef __APPLE__
     {
         WindowMatchInfo match = findWindowMatchByNameContains("Reflector 4");
         if (match.windowId == 0) match = findWindowMatchByNameContains("Reflector");
@@ -378,10 +504,19 @@ static int fromPixelsTest(const std::string &inputPath) {
             cout << "Reflector not found; using identity capture transform.\n";
         }
     }
+#else
+    State::resetCaptureTransform();
+#endif
+
+    // Detection runs on the card region only, as in the live loop.
+    Frame frame;
+    int x0, y0, x1, y1;
+    State::cardRegion(width, height, x0, y0, x1, y1);
+    frame.cropFrom(pixels.data(), width, height, (size_t)width * 4, x0, y0, x1, y1);
 
     State base;
 
-    State *detected = base.fromPixels(pixels.data(), width, height, 4, -1);
+    State *detected = base.fromFrame(frame, -1);
     if (detected == NULL) {
         cerr << "fromPixels returned NULL (no card detected).\n";
         if (width < 1800 || height < 1000) {
@@ -391,7 +526,12 @@ static int fromPixelsTest(const std::string &inputPath) {
     }
 
     cout << "Detected curCard=" << detected->curCard << " curRank=" << detected->curRank << " curSuit=" << detected->curSuit << "\n";
-    const int expectedCard = 8;
+    // Corpus images carry their label in the file name; otherwise expect the 8.
+    int expectedCard = 8;
+    int expectedRank, expectedSuit;
+    if (parseCardLabel(std::filesystem::path(inputPath).filename().string(), expectedRank, expectedSuit)) {
+        expectedCard = State::cardValue(expectedRank, expectedSuit);
+    }
     if (detected->curCard != expectedCard) {
         cerr << "Expected curCard=" << expectedCard << " but got " << detected->curCard << "\n";
         delete detected;
@@ -403,6 +543,147 @@ static int fromPixelsTest(const std::string &inputPath) {
     return 0;
 }
 
+// Offline recognition regression over the labelled screenshot corpus: checks
+// every image once, then measures fromFrame() throughput on all cores.
+static int recognitionBench(const std::string &dir, int passes) {
+    struct Sample {
+        std::string name;
+        int rank;
+        int suit;
+        Frame frame;
+    };
+    std::vector<Sample> samples;
+
+    std::vector<std::string> paths;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".png") {
+            paths.push_back(entry.path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    State::resetCaptureTransform();
+    for (const std::string &path : paths) {
+        Sample sample;
+        sample.name = std::filesystem::path(path).filename().string();
+        if (!parseCardLabel(sample.name, sample.rank, sample.suit)) continue;
+        if (!loadFrameFromImageFile(path, sample.frame)) {
+            cerr << "Failed to load image: " << path << "\n";
+            return 10;
+        }
+        samples.push_back(std::move(sample));
+    }
+    if (samples.empty()) {
+        cerr << "No labelled images (test<rank><suit>.png) in " << dir << "\n";
+        return 11;
+    }
+
+    State base;
+    int passed = 0;
+    double minConfidence = 1.0;
+    for (const Sample &sample : samples) {
+        CardReading reading;
+        State *detected = base.fromFrame(sample.frame, -1, &reading);
+        const bool ok = detected != NULL && detected->curRank == sample.rank && detected->curSuit == sample.suit;
+        cout << (ok ? "PASS " : "FAIL ") << sample.name
+             << " expected " << sample.rank << "/" << sample.suit << " got ";
+        if (detected != NULL) {
+            cout << detected->curRank << "/" << detected->curSuit << " confidence " << reading.confidence;
+            minConfidence = min(minConfidence, reading.confidence);
+        } else {
+            cout << "none";
+        }
+        cout << "\n";
+        if (ok) passed++;
+        delete detected;
+    }
+    cout << "accuracy: " << passed << "/" << samples.size()
+         << " (" << 100.0 * passed / samples.size() << "%), min confidence " << minConfidence << "\n";
+
+    const int numThreads = ThreadPool::global().size();
+    auto start = chrono::steady_clock::now();
+    ThreadPool::Group group;
+    for (int t = 0; t < numThreads; t++) {
+        group.run([&samples, passes]() {
+            State::resetCaptureTransform();
+            State local;
+            for (int p = 0; p < passes; p++) {
+                for (const Sample &sample : samples) {
+                    delete local.fromFrame(sample.frame, -1);
+                }
+            }
+        });
+    }
+    group.wait();
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    const double frames = (double)numThreads * passes * samples.size();
+    cout << "throughput: " << frames / seconds << " frames/s (" << numThreads << " threads, "
+         << (long long)frames << " frames in " << seconds << " s)\n";
+
+    return passed == (int)samples.size() ? 0 : 1;
+}
+
+// Trains the rank and suit probe trees on the labelled screenshot corpus and
+// writes them as recognition_tree.h; rebuild to use them.
+static int trainRecognition(const std::string &dir, const std::string &outPath) {
+    std::vector<std::string> paths;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".png") {
+            paths.push_back(entry.path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<ProbeTreeTrainer::Sample> samples;
+    for (const std::string &path : paths) {
+        ProbeTreeTrainer::Sample sample;
+        sample.name = std::filesystem::path(path).filename().string();
+        if (!parseCardLabel(sample.name, sample.rank, sample.suit)) continue;
+        if (!loadFrameFromImageFile(path, sample.frame)) {
+            cerr << "Failed to load image: " << path << "\n";
+            return 10;
+        }
+        samples.push_back(std::move(sample));
+    }
+    if (samples.empty()) {
+        cerr << "No labelled images (test<rank><suit>.png) in " << dir << "\n";
+        return 11;
+    }
+
+    ProbeTreeTrainer trainer(samples);
+    ProbeTreeTrainer::Tree ranks, suits;
+    std::string error;
+    if (!trainer.trainRanks(ranks, error) || !trainer.trainSuits(suits, error)) {
+        cerr << "Training failed: " << error << "\n";
+        return 12;
+    }
+    cout << samples.size() << " images: rank tree " << ranks.nodes.size() << " nodes, suit tree "
+         << suits.nodes.size() << " nodes\n";
+    double misreadConfidence = 0.0;
+    for (int shift = 0; shift <= ProbeTreeTrainer::kMaxRadius; shift++) {
+        int correct = 0, total = 0;
+        for (int dy = -shift; dy <= shift; dy++) {
+            for (int dx = -shift; dx <= shift; dx++) {
+                if (max(abs(dx), abs(dy)) != shift) continue;
+                correct += trainer.check(ranks, suits, dx, dy, misreadConfidence);
+                total += (int)samples.size();
+            }
+        }
+        cout << "read correctly with probes shifted " << shift << " px: " << correct << "/" << total << "\n";
+    }
+    // CardPipeline::kAcceptConfidence must stay above this for one-frame
+    // accepts to be safe.
+    cout << "highest confidence of a misread: " << misreadConfidence
+         << " (one-frame accept threshold " << CardPipeline::kAcceptConfidence << ")\n";
+    if (!ProbeTreeTrainer::write(outPath, ranks, suits, samples.size())) {
+        cerr << "Failed to write " << outPath << "\n";
+        return 13;
+    }
+    cout << "wrote " << outPath << "\n";
+    return 0;
+}
+
+#ifdef __APPLE__
 static int screenshotTest(const std::string &outputPath) {
     WindowMatchInfo match = findWindowMatchByNameContains("Reflector 4");
     if (match.windowId == 0) match = findWindowMatchByNameContains("Reflector");
@@ -452,129 +733,386 @@ static int screenshotTest(const std::string &outputPath) {
          << " h=" << winBounds.size.height << "\n";
     return 0;
 }
+#endif
+
+// Number of live tree nodes across all trees, counting every chance child a
+// decision node may still create, and its high-water mark.
+static atomic<long long> liveNodes(0);
+static atomic<long long> peakNodes(0);
+
+// Upper bound on live nodes during a search, 0 for no limit (--max-nodes).
+// Once reached, the tree stops growing and iterations only refine the
+// statistics of the nodes it already has.
+static long long maxTreeNodes = 0;
+
+// Rollouts stop after this many policy moves and are finished with the
+// learned value estimate (--rollout-depth, needs --value); 0 plays them out.
+static int rolloutDepth = 0;
+
+// Root iterations are allocated by sequential halving rather than UCB
+// (--halving; recorded in game logs for --replay); the tree below the root
+// is searched as usual.
+static bool sequentialHalving = false;
+
+// Games skip the search of forced moves and spread the time saved over the
+// decisions that remain (--schedule, see budget.h).
+static bool scheduleSearch = false;
+
+// Iterations per move in live games, or the per-move budget a scheduled live
+// game spreads.
+static const int kLiveIterations = 10000;
+
+static long long peakRssKB() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (long long)usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return (long long)usage.ru_maxrss;
+#endif
+}
 
-struct Node {
-    State * state;
-    Node *parent;
-    unordered_map<long long, Node *> children;
-    int visits;
-    double reward;
-    double squaredReward;
-    bool isChance;
-    mutex childMutex;
-    Node(State * state, Node * parent, bool isChance){
-        this->state = state;
-        this->parent = parent;
-        this->visits = 0;
-        this->reward = 0;
-        this->squaredReward = 0;
-        this->isChance = isChance;
-
-        if (!isChance){
-            //TODO: pass by reference
-            vector<State *> availableStates = state->getAvailableStates();
-
-            for(int i=0;i<availableStates.size();i++){
-                Node *child = new Node(availableStates[i], this, true);
-                addChild(child);
-            }
-        } else {
-            // Chance node children are added in the selection phase.
+static const uint32_t kNoNode = 0xFFFFFFFFu;
+
+// log(n) for visit counts. Counts below kSize are exact table entries; larger
+// ones are shifted into range and corrected by k*log(2), which is within
+// 1/kSize relative of N, far below what the exploration term can resolve.
+struct VisitLogTable {
+    static constexpr int kBits = 12;
+    static constexpr int kSize = 1 << kBits;
+    double values[kSize];
+
+    VisitLogTable() {
+        values[0] = 0.0;
+        for (int i = 1; i < kSize; i++) values[i] = log((double)i);
+    }
+
+    inline double operator()(uint32_t n) const {
+        if (n < (uint32_t)kSize) return values[n];
+        const int shift = (32 - __builtin_clz(n)) - kBits;
+        return values[n >> shift] + shift * 0.69314718055994530942;
+    }
+};
+
+static const VisitLogTable visitLog;
+
+// The search tree, stored as parallel arrays indexed by 32-bit node ids with
+// the root at 0. Selection statistics, topology and states live in separate
+// arrays so that comparing children only touches their statistics. A
+// decision node only lists its legal moves; the chance child for a move is
+// created the first time selection picks it, and until then its statistics
+// are implicitly zero.
+struct SearchTree {
+    struct Stats {
+        double reward;
+        double squaredReward;
+        int visits;
+    };
+
+    struct Links {
+        uint32_t parent;
+        uint32_t first;   // decision: first child slot; chance: first outcome
+        uint8_t count;    // number of legal moves / outcomes
+        int8_t move;      // chance: move taken from the parent, else -1
+        bool isChance;
+        bool materialised; // chance: state and outcomes built
+    };
+
+    // One possible draw at a chance node. The decision node it leads to is
+    // only created when the outcome is first selected. When the tree is full
+    // the outcome is rolled out without a node and its statistics are kept
+    // here instead.
+    struct Outcome {
+        int card;
+        double prob;
+        uint32_t node;
+        int leafVisits;
+        double leafReward;
+    };
+
+    // One legal move of a decision node, and its chance node once created.
+    struct Child {
+        uint32_t node;
+        int8_t move;
+    };
+
+    vector<Stats> stats;
+    vector<Links> links;
+    vector<State *> states;
+    vector<Outcome> outcomes;
+    vector<Child> children;
+    uint32_t chosen = kNoNode; // root child picked by MCTS()
+
+    // Takes ownership of `root`.
+    explicit SearchTree(State * root) {
+        addDecision(root, kNoNode);
+    }
+
+    ~SearchTree() {
+        for (State * state : states) {
+            delete state;
         }
+        liveNodes -= reserved;
+    }
+
+    SearchTree(const SearchTree &) = delete;
+    SearchTree &operator=(const SearchTree &) = delete;
+
+    uint32_t size() const { return (uint32_t)stats.size(); }
+
+    // Approximate bytes held per node, counting a materialised state.
+    static size_t bytesPerNode() {
+        return sizeof(Stats) + sizeof(Links) + sizeof(State *) + sizeof(State);
+    }
+
+    // True if expanding one more decision node (and its chance children)
+    // would exceed maxTreeNodes.
+    static bool treeFull() {
+        return maxTreeNodes > 0 && liveNodes.load() + 1 + State::kMaxMoves > maxTreeNodes;
+    }
+
+    State * chosenState() const {
+        return chosen == kNoNode ? NULL : states[chosen];
     }
 
-    // destructor
-    ~Node(){
-        for(auto it=children.begin();it!=children.end();it++){
-            delete it->second;
-            it->second = NULL;
+    // Adds a decision node for `state` (taking ownership) and records its
+    // legal moves. Returns the decision node's id. The node and all the
+    // children it may grow count against maxTreeNodes from here on.
+    uint32_t addDecision(State * state, uint32_t parent) {
+        uint8_t moves[State::kMaxMoves];
+        const int count = state->generateMoves(moves);
+        const uint32_t id = addNode(parent, state, false, -1);
+        links[id].first = (uint32_t)children.size();
+        links[id].count = (uint8_t)count;
+        for (int i = 0; i < count; i++) {
+            children.push_back({kNoNode, (int8_t)moves[i]});
         }
-        delete state;
-        state = NULL;
+        reserve(1 + count);
+        return id;
     }
 
-    void addChild(Node *child) {
-        children[child->hash_code()] = child;
+    // Chance node of decision `id`'s i-th move, or kNoNode if it has not
+    // been selected yet.
+    uint32_t child(uint32_t id, int i) const {
+        return children[links[id].first + i].node;
     }
-    void addReward(double reward) {
-        this->reward += reward;
-        this->squaredReward += reward*reward;
+
+    int childMove(uint32_t id, int i) const {
+        return children[links[id].first + i].move;
     }
-    void addVisit() {
-        this->visits++;
+
+    int childVisits(uint32_t id, int i) const {
+        const uint32_t node = child(id, i);
+        return node == kNoNode ? 0 : stats[node].visits;
     }
-    double getUCB1() {
-        if (this->visits <= 0) {
-            return 1000000000;
+
+    double childReward(uint32_t id, int i) const {
+        const uint32_t node = child(id, i);
+        return node == kNoNode ? 0.0 : stats[node].reward;
+    }
+
+    // Chance node of decision `id`'s i-th move, created on first use.
+    uint32_t expandChild(uint32_t id, int i) {
+        const uint32_t slot = links[id].first + (uint32_t)i;
+        if (children[slot].node == kNoNode) {
+            children[slot].node = addNode(id, NULL, true, children[slot].move);
         }
-        double mean = (double)reward/(double)visits;
-        return mean + sqrt(2*log(parent->visits)/(double)visits)
-            + sqrt((squaredReward - mean * mean * visits + 20) / (double)visits);
+        return children[slot].node;
     }
-    Node* getBestChild() {
-        Node *bestChild = NULL;
-        double bestUCB1 = -10000;
-        for(auto it=children.begin();it!=children.end();it++){
-            Node *child = it->second;
-            double UCB1 = child->getUCB1();
-            if (UCB1 > bestUCB1){
-                bestUCB1 = UCB1;
-                bestChild = child;
-            }
-            //cout << child->state->curMove << ":" << UCB1 << ",";
-            if (UCB1 == 1000000000){
-                return child;
+
+    // Applies a chance node's move to its parent's state and lists the
+    // possible draws with their probabilities, once.
+    void materialise(uint32_t id) {
+        Links &link = links[id];
+        if (link.materialised) return;
+        states[id] = states[link.parent]->applyMove(link.move);
+        int cards[11];
+        double probs[11];
+        const int count = states[id]->chanceOutcomes(cards, probs);
+        link.first = (uint32_t)outcomes.size();
+        link.count = (uint8_t)count;
+        link.materialised = true;
+        for (int i = 0; i < count; i++) {
+            outcomes.push_back({cards[i], probs[i], kNoNode, 0, 0.0});
+        }
+    }
+
+    int outcomeVisits(const Outcome &outcome) const {
+        return outcome.node != kNoNode ? stats[outcome.node].visits : outcome.leafVisits;
+    }
+
+    double outcomeReward(const Outcome &outcome) const {
+        return outcome.node != kNoNode ? stats[outcome.node].reward : outcome.leafReward;
+    }
+
+    // Adds the root statistics of `other`, a search from the same state, to
+    // this tree's root and root children.
+    void mergeRoot(const SearchTree &other) {
+        for (int i = 0; i < links[0].count; i++) {
+            const uint32_t from = other.child(0, i);
+            if (from == kNoNode) continue;
+            const uint32_t to = expandChild(0, i);
+            stats[to].reward += other.stats[from].reward;
+            stats[to].squaredReward += other.stats[from].squaredReward;
+            stats[to].visits += other.stats[from].visits;
+        }
+        stats[0].reward += other.stats[0].reward;
+        stats[0].squaredReward += other.stats[0].squaredReward;
+        stats[0].visits += other.stats[0].visits;
+    }
+
+    // Picks the outcome whose visit count falls furthest below its
+    // probability-proportional share, so visits track the exact distribution.
+    // Returns an index into `outcomes`.
+    uint32_t selectOutcome(uint32_t id) const {
+        const Links &link = links[id];
+        const double visits = (double)(stats[id].visits + 1);
+        uint32_t best = link.first;
+        double bestShortfall = -1e300;
+        for (uint32_t i = link.first; i < link.first + link.count; i++) {
+            const double shortfall = outcomes[i].prob * visits - (double)outcomeVisits(outcomes[i]);
+            if (shortfall > bestShortfall) {
+                bestShortfall = shortfall;
+                best = i;
             }
         }
-        //cout << endl;
-        return bestChild;
+        return best;
     }
-    Node* getBestEVChild() {
-        Node *bestChild = NULL;
+
+    // Replaces a chance node's running mean by the probability-weighted mean
+    // of its visited outcomes, renormalised over their total probability.
+    void reweightOutcomes(uint32_t id) {
+        const Links &link = links[id];
+        double weighted = 0.0;
+        double mass = 0.0;
+        for (uint32_t i = link.first; i < link.first + link.count; i++) {
+            const int visits = outcomeVisits(outcomes[i]);
+            if (visits <= 0) continue;
+            weighted += outcomes[i].prob * outcomeReward(outcomes[i]) / (double)visits;
+            mass += outcomes[i].prob;
+        }
+        if (mass > 0.0) {
+            stats[id].reward = weighted / mass * (double)stats[id].visits;
+        }
+    }
+
+    void addReward(uint32_t id, double reward) {
+        stats[id].reward += reward;
+        stats[id].squaredReward += reward * reward;
+        stats[id].visits++;
+    }
+
+    bool isLeaf(uint32_t id) const {
+        return links[id].count == 0;
+    }
+
+    // UCB1 selection over a decision node's moves; returns the move's index
+    // (see expandChild()). Moves without a visited child are collected in a
+    // bitmask and the first one is taken; otherwise the children's
+    // statistics are loaded into fixed-size arrays and every score is
+    // computed in one branch-free pass the compiler can vectorise.
+    int getBestChild(uint32_t id) const {
+        const Links &link = links[id];
+        const int count = link.count;
+        const Child *slot = &children[link.first];
+
+        uint32_t unvisited = 0;
+        for (int i = 0; i < count; i++) {
+            unvisited |= (uint32_t)(slot[i].node == kNoNode || stats[slot[i].node].visits <= 0) << i;
+        }
+        if (unvisited != 0) {
+            return __builtin_ctz(unvisited);
+        }
+
+        double visits[State::kMaxMoves];
+        double reward[State::kMaxMoves];
+        double squaredReward[State::kMaxMoves];
+        double ucb[State::kMaxMoves];
+        for (int i = 0; i < count; i++) {
+            const Stats &child = stats[slot[i].node];
+            visits[i] = (double)child.visits;
+            reward[i] = child.reward;
+            squaredReward[i] = child.squaredReward;
+        }
+        const double explore = 2.0 * visitLog((uint32_t)stats[id].visits);
+        for (int i = 0; i < count; i++) {
+            const double inv = 1.0 / visits[i];
+            const double mean = reward[i] * inv;
+            const double variance = max(0.0, squaredReward[i] - mean * mean * visits[i]) + 20;
+            ucb[i] = mean + sqrt(explore * inv) + sqrt(variance * inv);
+        }
+
+        int best = 0;
+        for (int i = 1; i < count; i++) {
+            if (ucb[i] > ucb[best]) best = i;
+        }
+        return best;
+    }
+
+    uint32_t getBestEVChild(uint32_t id) const {
+        const Links &link = links[id];
+        uint32_t bestChild = kNoNode;
         double bestEV = -1e300;
-        for(auto it=children.begin();it!=children.end();it++){
-            Node *child = it->second;
-            if (child == NULL || child->visits <= 0) {
+        for (int i = 0; i < link.count; i++) {
+            const uint32_t node = child(id, i);
+            if (node == kNoNode || stats[node].visits <= 0) {
                 continue;
             }
-            double EV = (double)child->reward/(double)child->visits;
+            double EV = stats[node].reward / (double)stats[node].visits;
             if (EV > bestEV){
                 bestEV = EV;
-                bestChild = child;
+                bestChild = node;
             }
         }
         return bestChild;
     }
-    Node* getMostVisitedChild() {
-        Node *bestChild = NULL;
+
+    uint32_t getMostVisitedChild(uint32_t id) const {
+        const Links &link = links[id];
+        uint32_t bestChild = kNoNode;
         int bestVisits = -1;
-        for(auto it=children.begin();it!=children.end();it++){
-            Node *child = it->second;
-            int visits = child->visits;
-            if (visits > bestVisits){
-                bestVisits = visits;
-                bestChild = child;
+        for (int i = 0; i < link.count; i++) {
+            const uint32_t node = child(id, i);
+            if (node != kNoNode && stats[node].visits > bestVisits){
+                bestVisits = stats[node].visits;
+                bestChild = node;
             }
         }
         return bestChild;
     }
-    bool isLeaf() {
-        return children.size()==0;
+
+    void print(uint32_t id) const {
+        states[id]->print();
+        cout<<"Visits: "<<stats[id].visits<<endl;
+        cout<<"Reward: "<<stats[id].reward<<endl;
+        cout<<"EV: "<<stats[id].reward/(double)stats[id].visits<<endl;
     }
-    void print() {
-        state->print();
-        cout<<"Visits: "<<visits<<endl;
-        cout<<"Reward: "<<reward<<endl;
-        //cout<<"UCB1: "<<getUCB1()<<endl;
-        cout<<"EV: "<<(double)reward/(double)visits<<endl;
+
+private:
+    uint32_t addNode(uint32_t parent, State * state, bool isChance, int move) {
+        const uint32_t id = size();
+        stats.push_back({0.0, 0.0, 0});
+        links.push_back({parent, 0, 0, (int8_t)move, isChance, false});
+        states.push_back(state);
+        return id;
     }
-    long long hash_code(){
-        return state->hash_code();
+
+    void reserve(int nodes) {
+        reserved += nodes;
+        const long long live = liveNodes += nodes;
+        long long peak = peakNodes.load();
+        while (live > peak && !peakNodes.compare_exchange_weak(peak, live)) {
+        }
     }
+
+    long long reserved = 0; // this tree's share of liveNodes
 };
-pair<double,double> mctsTask(Node * rootNode, int iters, double b = 0, double d = 1){
-    double initScore = rootNode->state->score;
-    double cardsLeft = rootNode->state->cardsLeft;
+
+// Runs `iters` iterations on `tree`. With `rootMove` >= 0 every iteration
+// starts with that root move instead of the UCB choice.
+pair<double,double> mctsTask(SearchTree &tree, int iters, double b = 0, double d = 1, int rootMove = -1){
+    double initScore = tree.states[0]->score;
+    double cardsLeft = tree.states[0]->cardsLeft;
     if (cardsLeft == 0){
         cardsLeft = 1;
     }
@@ -584,53 +1122,58 @@ pair<double,double> mctsTask(Node * rootNode, int iters, double b = 0, double d
     int minScore = 999;
     int maxScore = 0;
     for(int i = 0; i < iters; i++){
-        Node *node = rootNode;
+        uint32_t node = 0;
+        uint32_t leafOutcome = kNoNode;
+        State * simState = NULL;
 
-        // Selection and expansion
+        // Selection and expansion: descend until a new outcome is expanded or
+        // a terminal decision node is reached. With the tree full, a new
+        // outcome is rolled out from the chance node without expanding it.
         while(true){
-            // node->print();
-            // cout << "is chance: " << node->isChance << endl;
-            // getchar();
-            if (node->isChance){
-                State * state = node->state->sampleState();
-
-                Node * lockingNode = node;
-                long long hc = state->hash_code();
-                bool exists = node->children.count(hc);
-                if (!exists){
-                    Node *child = new Node(state, node, false);
-                    node->addChild(child);
+            if (tree.links[node].isChance){
+                tree.materialise(node);
+                const uint32_t outcome = tree.selectOutcome(node);
+                if (tree.outcomes[outcome].node == kNoNode){
+                    State * next = tree.states[node]->nextState(tree.outcomes[outcome].card);
+                    if (SearchTree::treeFull()){
+                        leafOutcome = outcome;
+                        simState = next;
+                        break;
+                    }
+                    const uint32_t child = tree.addDecision(next, node);
+                    tree.outcomes[outcome].node = child;
                     node = child;
-                } else {
-                    node = node->children[hc];
-                    delete state;
-                }
-            } else {
-                if (node->isLeaf()){
                     break;
                 }
-
-                // cout << "iter: " << i << ", " << node->children.size() << endl;
-                // node->print();
-                Node * parentNode = node;
-                node = node->getBestChild();
-                // cout << "best move: " << node->state->curMove << endl;
-                // getchar();
-
-                if (node->visits <= 0 && parentNode->children.size() > 1){
+                node = tree.outcomes[outcome].node;
+            } else {
+                if (tree.isLeaf(node)){
                     break;
                 }
+                const int move = (node == 0 && rootMove >= 0) ? rootMove : tree.getBestChild(node);
+                node = tree.expandChild(node, move);
             }
         }
-        State * simState = node->state->sampleState();
+        // Rollouts start from the decision state reached above.
+        if (simState == NULL) {
+            simState = new State(tree.states[node]);
+        }
         bool shouldPrint = simState->cardsLeft >= 50;
         
         double reward = 0;
         double scaleFactor = 100 * cardsLeft / 51;
 
+        const ValueFunction &value = ValueFunction::active();
+        const int maxSteps = (rolloutDepth > 0 && value.loaded) ? rolloutDepth : INT_MAX;
+        int steps = 0;
+        double estimate = 0;
         while (!simState->isTerminal()){
             // simState->print();
             // getchar();
+            if (steps++ >= maxSteps){
+                estimate = value.remaining(*simState);
+                break;
+            }
             if (!simState->makeSmartMove()){
                 break;
             }
@@ -639,13 +1182,14 @@ pair<double,double> mctsTask(Node * rootNode, int iters, double b = 0, double d
             delete oldState;
         }
 
-        minScore = min(minScore, simState->score - simState->numUndo / 5);
-        maxScore = max(maxScore, simState->score - simState->numUndo / 5);
+        const double finalScore = simState->score - simState->numUndo / 5 + estimate;
+        minScore = min(minScore, (int)finalScore);
+        maxScore = max(maxScore, (int)finalScore);
     
         if (b > 0){
-            reward = (simState->score - simState->numUndo / 5 - b) / d;
+            reward = (finalScore - b) / d;
         } else {
-            reward = (simState->score - simState->numUndo / 5 - initScore - scaleFactor) / scaleFactor;
+            reward = (finalScore - initScore - scaleFactor) / scaleFactor;
         }
 
 
@@ -655,10 +1199,16 @@ pair<double,double> mctsTask(Node * rootNode, int iters, double b = 0, double d
         }
 
         // Backpropagation
-        while(node!=NULL){
-            node->addReward(reward);
-            node->addVisit();
-            node = node->parent;
+        if (leafOutcome != kNoNode){
+            tree.outcomes[leafOutcome].leafVisits++;
+            tree.outcomes[leafOutcome].leafReward += reward;
+        }
+        while(node != kNoNode){
+            tree.addReward(node, reward);
+            if (tree.links[node].isChance){
+                tree.reweightOutcomes(node);
+            }
+            node = tree.links[node].parent;
         }
 
         delete simState;
@@ -668,136 +1218,342 @@ pair<double,double> mctsTask(Node * rootNode, int iters, double b = 0, double d
     return make_pair(minScore, maxScore);
 }
 
-Node* MCTS(State * state, int iterations) {
-    Node *copy = new Node(new State(state), NULL, false);
-    auto minmax = mctsTask(copy, iterations / 100);
+// Sequential halving over the root moves of `trees` (searched in parallel,
+// one task per tree): the budget is split evenly between ceil(log2 K)
+// rounds, every surviving move gets the same share of a round, and the
+// better half by mean reward over all trees goes on to the next. Returns the
+// index of the last move left.
+static int halveRootMoves(SearchTree *trees[], int iterations, double b, double d) {
+    const int count = trees[0]->links[0].count;
+    vector<int> alive;
+    for (int i = 0; i < count; i++) alive.push_back(i);
+    int rounds = 0;
+    while ((1 << rounds) < count) rounds++;
+    for (int round = 0; round < rounds && alive.size() > 1; round++) {
+        const int perMove = max(1, iterations / (rounds * (int)alive.size() * NUM_THREADS));
+        ThreadPool::Group group;
+        for (int t = 0; t < NUM_THREADS; t++) {
+            const uint64_t seed = ((uint64_t)State::nextRandom() << 32) | State::nextRandom();
+            SearchTree *searched = trees[t];
+            group.run([=]() {
+                const uint64_t saved = State::rngState;
+                State::seedRandom(seed);
+                for (int move : alive) mctsTask(*searched, perMove, b, d, move);
+                State::rngState = saved;
+            });
+        }
+        group.wait();
+
+        vector<pair<double, int>> ranked;
+        for (int move : alive) {
+            double reward = 0.0;
+            int visits = 0;
+            for (int t = 0; t < NUM_THREADS; t++) {
+                reward += trees[t]->childReward(0, move);
+                visits += trees[t]->childVisits(0, move);
+            }
+            ranked.push_back(make_pair(visits > 0 ? reward / visits : -1e300, move));
+        }
+        stable_sort(ranked.begin(), ranked.end(),
+                    [](const pair<double, int> &x, const pair<double, int> &y) { return x.first > y.first; });
+        alive.clear();
+        for (size_t i = 0; i < (ranked.size() + 1) / 2; i++) alive.push_back(ranked[i].second);
+    }
+    return alive[0];
+}
+
+// Searches from `state`, which the returned tree takes ownership of. The
+// chosen root child is tree->chosen (kNoNode if there is no legal move).
+// A forced move (a single legal move; piles in identical states are already
+// one move) is returned without searching.
+SearchTree* MCTS(State * state, int iterations) {
+    SearchTree *tree = new SearchTree(state);
+    if (tree->links[0].count <= 1) {
+        if (!tree->isLeaf(0)) {
+            tree->chosen = tree->expandChild(0, 0);
+            tree->materialise(tree->chosen);
+        }
+        return tree;
+    }
+    SearchTree *copy = new SearchTree(new State(state));
+    auto minmax = mctsTask(*copy, iterations / 100);
     delete copy;
-    Node *root = new Node(state, NULL, false);
-    thread t[NUM_THREADS];
-    int iters = iterations / NUM_THREADS;
-    for(int i=0;i<NUM_THREADS;i++){
-        t[i] = thread(mctsTask, root, iters, (minmax.second - minmax.first) / 2 + minmax.first, (minmax.second - minmax.first) / 2);
+    // Root parallelism: NUM_THREADS independent trees are searched as pool
+    // tasks and their root statistics summed into the first.
+    SearchTree *trees[NUM_THREADS];
+    trees[0] = tree;
+    for(int i=1;i<NUM_THREADS;i++){
+        trees[i] = new SearchTree(new State(state));
+    }
+    const double b = (minmax.second - minmax.first) / 2 + minmax.first;
+    const double d = (minmax.second - minmax.first) / 2;
+    int halvingChoice = -1;
+    if (sequentialHalving && tree->links[0].count > 1) {
+        halvingChoice = halveRootMoves(trees, iterations, b, d);
+    } else {
+        int iters = iterations / NUM_THREADS;
+        ThreadPool::Group group;
+        for(int i=0;i<NUM_THREADS;i++){
+            // Search tasks draw from their own random streams, seeded from ours.
+            const uint64_t seed = ((uint64_t)State::nextRandom() << 32) | State::nextRandom();
+            SearchTree *searched = trees[i];
+            group.run([=]() {
+                const uint64_t saved = State::rngState;
+                State::seedRandom(seed);
+                mctsTask(*searched, iters, b, d);
+                State::rngState = saved;
+            });
+        }
+        group.wait();
     }
-    for(int i=0;i<NUM_THREADS;i++){
-        t[i].join();
+    for(int i=1;i<NUM_THREADS;i++){
+        tree->mergeRoot(*trees[i]);
+        delete trees[i];
     }
 
     // Final-action selection policy (per request):
     // - If there are 6+ cards left, choose the most-visited child (more robust earlier).
     // - If there are <6 cards left, choose the best-EV child (optimize endgame decisions).
-    Node *most = root->getMostVisitedChild();
-    Node *best = root->getBestEVChild();
-    if (root->state != NULL && root->state->cardsLeft < 4) {
-        if (best != NULL) return best;
-        return most;
-    }
-    if (most != NULL) return most;
-    return best;
+    // - With sequential halving, the move that survived every round.
+    const uint32_t most = tree->getMostVisitedChild(0);
+    const uint32_t best = tree->getBestEVChild(0);
+    uint32_t chosen = (most != kNoNode) ? most : best;
+    if (state->cardsLeft < 4 && best != kNoNode) {
+        chosen = best;
+    }
+    if (halvingChoice >= 0) {
+        chosen = tree->expandChild(0, halvingChoice);
+    }
+    if (chosen == kNoNode && !tree->isLeaf(0)) {
+        chosen = tree->expandChild(0, 0);
+    }
+    if (chosen != kNoNode) {
+        tree->materialise(chosen);
+    }
+    tree->chosen = chosen;
+    return tree;
 }
 
-int windowX,windowY,windowW,windowH;
+// Move of the root child MCTS() chose, or -1.
+static int chosenMove(const SearchTree *tree) {
+    return tree->chosen == kNoNode ? -1 : tree->links[tree->chosen].move;
+}
 
-State * sampleFromScreenshot(State * state, int prevCard){
-    // Cache the window id so we don't scan the full window list every frame.
-    // If Reflector restarts (window id changes), we'll re-discover on failure.
-    static CGWindowID reflectorWindowId = 0;
-    const std::string target = "Reflector 4";
-    while(true){
+// Makes the root's child for `move` the chosen one; false if `move` is not
+// legal at the root.
+static bool chooseMove(SearchTree *tree, int move) {
+    for (int i = 0; i < tree->links[0].count; i++) {
+        if (tree->childMove(0, i) == move) {
+            tree->chosen = tree->expandChild(0, i);
+            tree->materialise(tree->chosen);
+            return true;
+        }
+    }
+    return false;
+}
 
-        overlay_step(0.001);
-        overlay_redraw();
-        if (reflectorWindowId == 0) {
-            reflectorWindowId = findWindowIdByNameContains(target);
-            // Fallback: sometimes the owner/title just contains "Reflector".
-            if (reflectorWindowId == 0) {
-                reflectorWindowId = findWindowIdByNameContains("Reflector");
-            }
-            if (reflectorWindowId == 0) {
-                this_thread::sleep_for(chrono::milliseconds(250));
+// A tree for `state` (taking ownership) whose chosen child is the opening
+// book's move, without searching; NULL (and `state` untouched) if the book
+// has no entry for it.
+static SearchTree *bookMove(State * state) {
+    const int move = OpeningBook::active().lookup(*state);
+    if (move < 0) return NULL;
+    SearchTree *tree = new SearchTree(state);
+    chooseMove(tree, move);
+    return tree;
+}
+
+// Deep-searches every position of the first `decisions` decisions that has
+// more than one legal move, on the thread pool, and writes the book.
+int buildOpeningBook(int decisions, int iterations, const string &outPath) {
+    vector<State *> positions;
+    unordered_set<uint64_t> seen;
+    vector<State *> frontier;
+    {
+        State start;
+        int cards[11];
+        double probs[11];
+        const int count = start.chanceOutcomes(cards, probs);
+        for (int i = 0; i < count; i++) frontier.push_back(start.nextState(cards[i]));
+    }
+    for (int depth = 1; depth <= decisions && !frontier.empty(); depth++) {
+        vector<State *> next;
+        for (State * s : frontier) {
+            int perm[State::kPiles];
+            if (s->isTerminal() || !seen.insert(OpeningBook::canonicalKey(*s, perm)).second) {
+                delete s;
                 continue;
             }
+            uint8_t moves[State::kMaxMoves];
+            const int count = s->generateMoves(moves);
+            if (depth < decisions) {
+                for (int m = 0; m < count; m++) {
+                    State * moved = s->applyMove(moves[m]);
+                    int cards[11];
+                    double probs[11];
+                    const int outcomes = moved->chanceOutcomes(cards, probs);
+                    for (int i = 0; i < outcomes; i++) next.push_back(moved->nextState(cards[i]));
+                    delete moved;
+                }
+            }
+            if (count > 1) {
+                positions.push_back(s);
+            } else {
+                delete s;
+            }
         }
-
-        CGRect winBounds;
-        if (!getWindowBounds(reflectorWindowId, winBounds)) {
-            reflectorWindowId = 0;
-            this_thread::sleep_for(chrono::milliseconds(250));
-            continue;
+        frontier = next;
+    }
+    for (State * s : frontier) delete s;
+
+    cout << positions.size() << " book positions, " << iterations << " iterations each" << endl;
+    OpeningBook book;
+    book.entries.resize(positions.size());
+    atomic<size_t> done(0);
+    mutex printMutex;
+    auto started = chrono::steady_clock::now();
+    ThreadPool::global().parallelFor(positions.size(), [&](size_t i) {
+        int perm[State::kPiles];
+        BookEntry &entry = book.entries[i];
+        memset(&entry, 0, sizeof(entry));
+        entry.key = OpeningBook::canonicalKey(*positions[i], perm);
+        entry.iterations = (uint32_t)iterations;
+        const uint64_t saved = State::rngState;
+        State::seedRandom(entry.key);
+        SearchTree *tree = MCTS(new State(positions[i]), iterations);
+        State::rngState = saved;
+        entry.numMoves = tree->links[0].count;
+        for (int m = 0; m < entry.numMoves; m++) {
+            const int visits = tree->childVisits(0, m);
+            entry.moves[m] = (uint8_t)OpeningBook::toCanonical(tree->childMove(0, m), perm);
+            entry.visits[m] = (uint32_t)max(0, visits);
+            entry.meanReward[m] = visits > 0 ? (float)(tree->childReward(0, m) / visits) : 0.0f;
         }
+        entry.bestMove = (int8_t)OpeningBook::toCanonical(chosenMove(tree), perm);
+        delete tree;
+
+        const size_t finished = ++done;
+        lock_guard<mutex> lock(printMutex);
+        const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        cout << "\r" << finished << "/" << positions.size() << " (" << elapsed << " s)" << flush;
+    });
+    cout << endl;
+    ThreadPool::global().printStats(cout);
+    for (State * s : positions) delete s;
+
+    if (!book.save(outPath)) {
+        cerr << "Failed to write the opening book to " << outPath << endl;
+        return 1;
+    }
+    cout << "written to " << outPath << endl;
+    return 0;
+}
 
-        // If we latched onto a tiny helper window, drop it and re-discover.
-        if (!CGRectIsNull(winBounds) && (winBounds.size.width < 200.0 || winBounds.size.height < 200.0)) {
-            cerr << "Rejecting tiny Reflector match (points): w=" << winBounds.size.width
-                 << " h=" << winBounds.size.height << " (id=" << reflectorWindowId << ")\n";
-            reflectorWindowId = 0;
-            this_thread::sleep_for(chrono::milliseconds(250));
-            continue;
-        }
-        // set window vars
-        windowX = (int)winBounds.origin.x;
-        windowY = (int)winBounds.origin.y;
-        windowW = (int)winBounds.size.width;
-        windowH = (int)winBounds.size.height;
-        //cout << "(" << windowX << ", " << windowY << ", " << windowW << ", " << windowH << ")" << endl;
-
-        CGImageRef img = captureWindowImage(reflectorWindowId);
-        if (img == nullptr) {
-            // Window likely went away; re-discover.
-            reflectorWindowId = 0;
-            this_thread::sleep_for(chrono::milliseconds(250));
-            continue;
-        }
+// Clearability table for makeSmartMove() (see clearable.h): written by
+// --calc-clearable, and read only when --clearable names it.
+static string clearablePath = "clearable.bin";
 
-        std::vector<uint8_t> pixelsBGRA;
-        int width = 0;
-        int height = 0;
-        if (!copyCGImageToBGRA(img, pixelsBGRA, width, height)) {
-            CGImageRelease(img);
-            this_thread::sleep_for(chrono::milliseconds(250));
-            continue;
-        }
-        CGImageRelease(img);
-        const int bpp = 4;
-
-        // NOTE: captureWindowImage() returns a *window-only* buffer, and State::getRGB()
-        // already scales from a reference (714x1056) into (width,height).
-        // Applying a screen->window transform here would shift samples out of bounds.
-        State::resetCaptureTransform();
-
-        State * ret = state->fromPixels((uint8 *)pixelsBGRA.data(), width, height, bpp, prevCard);
-        this_thread::sleep_for(chrono::milliseconds(50));
-        CGImageRef img2 = captureWindowImage(reflectorWindowId);
-        if (img2 == nullptr) {
-            reflectorWindowId = 0;
-            if (ret != NULL) delete ret;
-            this_thread::sleep_for(chrono::milliseconds(250));
-            continue;
-        }
+bool readClearable() {
+    return ClearTable::active().read(clearablePath);
+}
 
-        std::vector<uint8_t> pixels2BGRA;
-        int width2 = 0;
-        int height2 = 0;
-        State * ret2 = NULL;
-        if (copyCGImageToBGRA(img2, pixels2BGRA, width2, height2)) {
-            ret2 = state->fromPixels((uint8 *)pixels2BGRA.data(), width2, height2, 4, prevCard);
-        }
-        CGImageRelease(img2);
-        if (ret == NULL){
-            this_thread::sleep_for(chrono::milliseconds(50));
-        } else {
-            if (ret2 == NULL || ret2->curRank != ret->curRank || ret2->curSuit != ret->curSuit){
-                delete ret2;
-                delete ret;
+void calcClearable(bool verbose) {
+    auto started = chrono::steady_clock::now();
+    ClearTable::active().calc();
+    if (verbose) {
+        const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        cout << ClearTable::active().entries.size() << " clearability entries ("
+             << ClearTable::kProfiles << " deck profiles) in " << elapsed << " s" << endl;
+    }
+}
+
+bool writeClearable() {
+    return ClearTable::active().write(clearablePath);
+}
+
+void printTreeMemory() {
+    const long long peak = peakNodes.load();
+    cout << "peak tree nodes: " << peak << " (~"
+         << peak * (long long)SearchTree::bytesPerNode() / (1024 * 1024) << " MB)"
+         << ", peak RSS: " << peakRssKB() / 1024 << " MB" << endl;
+}
+
+int windowX,windowY,windowW,windowH;
+
+#ifdef __APPLE__
+// Live frames: the card region of the Reflector window. Retries until the
+// window can be found and captured, so it never runs dry.
+class WindowCaptureSource : public FrameSource {
+public:
+    bool next(Frame &frame, FrameMeta &meta) override {
+        const std::string target = "Reflector 4";
+        while (true) {
+            // Cache the window id so we don't scan the full window list every
+            // frame. If Reflector restarts (window id changes), we'll
+            // re-discover on failure.
+            if (windowId == 0) {
+                windowId = findWindowIdByNameContains(target);
+                // Fallback: sometimes the owner/title just contains "Reflector".
+                if (windowId == 0) {
+                    windowId = findWindowIdByNameContains("Reflector");
+                }
+                if (windowId == 0) {
+                    this_thread::sleep_for(chrono::milliseconds(250));
+                    continue;
+                }
+            }
+
+            CGRect winBounds;
+            if (!getWindowBounds(windowId, winBounds)) {
+                windowId = 0;
+                this_thread::sleep_for(chrono::milliseconds(250));
+                continue;
+            }
+
+            // If we latched onto a tiny helper window, drop it and re-discover.
+            if (!CGRectIsNull(winBounds) && (winBounds.size.width < 200.0 || winBounds.size.height < 200.0)) {
+                cerr << "Rejecting tiny Reflector match (points): w=" << winBounds.size.width
+                     << " h=" << winBounds.size.height << " (id=" << windowId << ")\n";
+                windowId = 0;
+                this_thread::sleep_for(chrono::milliseconds(250));
+                continue;
+            }
+            meta.windowX = (int)winBounds.origin.x;
+            meta.windowY = (int)winBounds.origin.y;
+            meta.windowW = (int)winBounds.size.width;
+            meta.windowH = (int)winBounds.size.height;
+
+            meta.captureStartUs = monotonicUs();
+            CGImageRef img = captureWindowImage(windowId);
+            meta.captureEndUs = monotonicUs();
+            if (img == nullptr) {
+                // Window likely went away; re-discover.
+                windowId = 0;
+                this_thread::sleep_for(chrono::milliseconds(250));
                 continue;
             }
-            delete ret2;
 
-            cout << "detected " << ret->curRank << " " << ret->curSuit << endl;
-            return ret;
+            // NOTE: captureWindowImage() returns a *window-only* buffer, and
+            // State::getRGB() already scales from a reference (714x1056) into
+            // (width,height), so no screen->window transform is applied.
+            // Only the card region is converted, into the ring slot's frame.
+            const bool copied = copyCGImageRegionToFrame(img, frame);
+            CGImageRelease(img);
+            meta.convertEndUs = monotonicUs();
+            if (!copied) {
+                this_thread::sleep_for(chrono::milliseconds(250));
+                continue;
+            }
+            return true;
         }
     }
-    return NULL;
-}
+
+    bool live() const override { return true; }
+
+private:
+    CGWindowID windowId = 0;
+};
+#endif
 
 // bad case
 // totals: 9 0 0 11 
@@ -851,10 +1607,10 @@ void test1(){
     state->lastPos = 0;
     state->prevCard = 6;
 
-    Node *root = MCTS(state, 100000);
+    SearchTree *tree = MCTS(state, 100000);
     cerr << "done" << endl;
-    cerr << root << endl;
-    root->state->print();
+    cerr << tree->chosen << endl;
+    tree->chosenState()->print();
 }
 
 void test2(){
@@ -900,12 +1656,12 @@ void test3(){
     state->undoCounter = 1;
     state->numUndo = 1;
 
-    Node *root = MCTS(state, 100000);
+    SearchTree *tree = MCTS(state, 100000);
     cerr << "done" << endl;
-    cerr << root << endl;
-    root->state->print();
+    cerr << tree->chosen << endl;
+    tree->chosenState()->print();
 
-            cout << root->visits << "/" << root->parent->visits << endl;
+            cout << tree->stats[tree->chosen].visits << "/" << tree->stats[0].visits << endl;
 }
 
 void test4(){
@@ -951,57 +1707,407 @@ void test4(){
     state->numUndo = 5;
     state->justUndid = false;
 
-    Node *root = MCTS(state, 100000);
+    SearchTree *tree = MCTS(state, 100000);
     cerr << "done" << endl;
-    cerr << root << endl;
-    root->state->print();
+    cerr << tree->chosen << endl;
+    tree->chosenState()->print();
 
-    cout << root->visits << "/" << root->parent->visits << endl;
+    cout << tree->stats[tree->chosen].visits << "/" << tree->stats[0].visits << endl;
 }
 
+// Plays 1000 searched games, as many at once as the pool has workers, and
+// reports the running average as games finish.
 void simulate(){
+    const int games = 1000;
+    const uint64_t seedBase = (uint64_t)time(NULL);
+    atomic<int> next(0);
+    mutex printMutex;
     double cumScore = 0;
     int numGames = 0;
-    srand(time(NULL));
-    while(true){
-        numGames++;
-        State * state = new State();
-        State * initState = state;
-        State * sampled = state->sampleState();
-        state = sampled;
+    ThreadPool::Group group;
+    for (int t = 0; t < ThreadPool::global().size(); t++) {
+        group.run([&]() {
+            const uint64_t saved = State::rngState;
+            int g;
+            while ((g = next.fetch_add(1)) < games) {
+                State::seedRandom(seedBase + (uint64_t)g);
+                State start;
+                State * state = start.sampleState();
+                SearchBudget budget(1000);
+                while (!state->isTerminal()) {
+                    SearchTree *tree = bookMove(state);
+                    if (tree == NULL) {
+                        tree = MCTS(state, scheduleSearch ? budget.iterationsFor(*state) : 1000);
+                    }
+                    state = tree->chosenState()->sampleState();
+                    delete tree;
+                }
 
-        vector<Node *> toDelete;
-        while(true){
-            state->print();
-            //getchar();
-            if(state == NULL){
-                cerr << "NULL STATE wtf" << endl;
+                lock_guard<mutex> lock(printMutex);
+                numGames++;
+                cumScore += state->score;
+                cout << "score = " << state->score << endl;
+                cout << "average score: " << cumScore / numGames << endl;
+                cout << "num games: " << numGames << endl;
+                printTreeMemory();
+                delete state;
             }
-            if (state->isTerminal()){
-                break;
+            State::rngState = saved;
+        });
+    }
+    group.wait();
+    ThreadPool::global().printStats(cout);
+}
+
+// Plays `games` searched games and records every decision to `dir` (see
+// dataset.h). Game g is dealt from seed (seedBase + g); without --seed the
+// base is the run's random id, so concurrent runs deal different games.
+int selfPlay(int games, int iterations, const string &dir, const char *seed) {
+    std::error_code ec;
+    filesystem::create_directories(dir, ec);
+    random_device device;
+    const uint64_t runId = ((uint64_t)device() << 32 | device()) ^ (uint64_t)getpid();
+    const uint64_t seedBase = seed != NULL ? strtoull(seed, NULL, 10) : runId;
+    cout << "self-play run " << hex << runId << dec << ", seed " << seedBase << endl;
+    // Games run in parallel, one per pool worker at a time, each writing its
+    // own chunk files.
+    const int numTasks = ThreadPool::global().size();
+    vector<unique_ptr<DatasetWriter>> writers;
+    for (int t = 0; t < numTasks; t++) {
+        writers.emplace_back(new DatasetWriter(dir, t, runId));
+    }
+    atomic<int> next(0);
+    mutex printMutex;
+    double cumScore = 0;
+    int finished = 0;
+    auto started = chrono::steady_clock::now();
+    ThreadPool::Group group;
+    for (int t = 0; t < numTasks; t++) {
+        group.run([&, t]() {
+            DatasetWriter &writer = *writers[t];
+            const uint64_t saved = State::rngState;
+            int g;
+            while ((g = next.fetch_add(1)) < games) {
+                State::seedRandom(seedBase + (uint64_t)g);
+                State start;
+                State * state = start.sampleState();
+                int ply = 0;
+                SearchBudget budget(iterations);
+                while (!state->isTerminal()) {
+                    State * searched = new State(state);
+                    SearchTree *tree = MCTS(state, scheduleSearch ? budget.iterationsFor(*searched) : iterations);
+                    if (tree->chosen == kNoNode) {
+                        delete tree;
+                        state = searched;
+                        break;
+                    }
+                    // A forced move was not searched (see MCTS()): there are no
+                    // visits to learn from, so only its ply is counted.
+                    if (tree->links[0].count <= 1) {
+                        ply++;
+                    } else {
+                        SelfPlayRecord record;
+                        memset(&record, 0, sizeof(record));
+                        record.state = PackedState::pack(*searched);
+                        record.game = (uint32_t)g;
+                        record.ply = (uint16_t)ply++;
+                        record.numMoves = tree->links[0].count;
+                        for (int i = 0; i < record.numMoves; i++) {
+                            const int visits = tree->childVisits(0, i);
+                            record.moves[i] = (uint8_t)tree->childMove(0, i);
+                            record.visits[i] = (uint32_t)max(0, visits);
+                            record.meanReward[i] = visits > 0 ? (float)(tree->childReward(0, i) / visits) : 0.0f;
+                        }
+                        record.chosenMove = tree->links[tree->chosen].move;
+                        writer.add(record);
+                    }
+                    delete searched;
+
+                    state = tree->chosenState()->sampleState();
+                    delete tree;
+                }
+                const int finalScore = state->score - state->numUndo / 5;
+                writer.endGame(finalScore);
+                delete state;
+
+                lock_guard<mutex> lock(printMutex);
+                cumScore += finalScore;
+                finished++;
+                cout << "game " << (g + 1) << ": " << finalScore << " (average " << cumScore / finished << ")" << endl;
             }
-            Node *root = MCTS(state, 1000);
-            state = root->state;
+            State::rngState = saved;
+        });
+    }
+    group.wait();
+    size_t records = 0;
+    for (auto &writer : writers) {
+        if (!writer->flush()) return 1;
+        records += writer->recordsWritten();
+    }
+    const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    cout << records << " records in " << elapsed << " s, written to " << dir << endl;
+    ThreadPool::global().printStats(cout);
+    return 0;
+}
 
-            State * sampled = state->sampleState();
+// Hash of everything loaded from files that changes the chosen move: the
+// rollout weights, value function, clearability table and opening book.
+static uint64_t setupHash() {
+    uint64_t hash = 1469598103934665603ull;
+    size_t count;
+    const SmartMoveWeights::Field *fields = SmartMoveWeights::fields(count);
+    const SmartMoveWeights &weights = *SmartMoveWeights::active();
+    for (size_t i = 0; i < count; i++) {
+        hash = hashBytes(hash, &(weights.*fields[i].member), sizeof(double));
+    }
+    const ValueFunction &value = ValueFunction::active();
+    hash = hashBytes(hash, &value.loaded, sizeof(value.loaded));
+    if (value.loaded) hash = hashBytes(hash, value.weights, sizeof(value.weights));
+    const ClearTable &clearTable = ClearTable::active();
+    hash = hashBytes(hash, &clearTable.loaded, sizeof(clearTable.loaded));
+    if (clearTable.loaded) {
+        hash = hashBytes(hash, clearTable.entries.data(), clearTable.entries.size() * sizeof(ClearTable::Entry));
+    }
+    const OpeningBook &book = OpeningBook::active();
+    hash = hashBytes(hash, &book.loaded, sizeof(book.loaded));
+    if (book.loaded) hash = hashBytes(hash, book.entries.data(), book.entries.size() * sizeof(BookEntry));
+    return hash;
+}
 
-            state = sampled;
-            cout << root->visits << "/" << root->parent->visits << endl;
-            delete root->parent;
+// Runs the search for one logged decision with the logged seed and limits.
+static SearchTree *searchLogged(State * state, const GameLogEntry &entry) {
+    const int savedDepth = rolloutDepth;
+    const long long savedMaxNodes = maxTreeNodes;
+    const bool savedHalving = sequentialHalving;
+    rolloutDepth = entry.rolloutDepth;
+    maxTreeNodes = entry.maxTreeNodes;
+    sequentialHalving = (entry.flags & GameLogEntry::kSequentialHalving) != 0;
+    State::seedRandom(entry.seed);
+    SearchTree *tree = MCTS(state, (int)entry.iterations);
+    rolloutDepth = savedDepth;
+    maxTreeNodes = savedMaxNodes;
+    sequentialHalving = savedHalving;
+    return tree;
+}
+
+// Re-runs every search of a live game log headlessly and compares the moves
+// and search times with the recorded ones.
+int replayGameLog(const string &path) {
+    vector<GameLogEntry> entries;
+    if (!readGameLog(path, entries)) {
+        cerr << "Could not read game log " << path << endl;
+        return 1;
+    }
+
+    State * state = NULL;
+    SearchTree * tree = NULL;
+    int games = 0, decisions = 0, mismatches = 0, otherSetup = 0;
+    const uint64_t setup = setupHash();
+    vector<double> loggedMs, replayMs;
+    for (const GameLogEntry &entry : entries) {
+        if (entry.kind == GameLogEntry::kGameStart) {
+            if (tree != NULL) {
+                delete tree;
+                tree = NULL;
+            } else {
+                delete state;
+            }
+            state = new State();
+            games++;
+            if (entry.setup != setup) {
+                otherSetup++;
+                cout << "game " << games << " was played with other weights, value function, clearability table"
+                     << " or book (--weights, --value, --clearable, --book); its moves may differ" << endl;
+            }
+            continue;
+        }
+        if (entry.kind != GameLogEntry::kCard || state == NULL) continue;
+
+        State * prev = (tree == NULL) ? state : tree->chosenState();
+        State * next = prev->sampleState(entry.rank * 4 + entry.suit);
+        if (tree != NULL) {
+            delete tree;
+            tree = NULL;
+        } else {
+            delete state;
+        }
+        state = next;
+        if (entry.chosenMove == -1 && state->isTerminal()) {
+            continue;
         }
 
-        cumScore += state->score;
-        cout << "score = " << state->score << endl;
-        cout << "average score: " << cumScore / numGames << endl;
-        cout << "num games: " << numGames << endl;
-        delete initState;
+        auto started = chrono::steady_clock::now();
+        tree = (entry.iterations == 0) ? bookMove(state) : searchLogged(state, entry);
+        if (tree == NULL) {
+            cerr << "Logged book move, but the position is not in the loaded book (--book)" << endl;
+            delete state;
+            return 1;
+        }
+        const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+        const int move = chosenMove(tree);
+        decisions++;
+        loggedMs.push_back(entry.searchUs / 1000.0);
+        replayMs.push_back(ms);
+        if (move != entry.chosenMove) {
+            // The logged cards follow the logged move, so the game goes on
+            // from it.
+            mismatches++;
+            if (entry.chosenMove != -1) chooseMove(tree, entry.chosenMove);
+        }
+        cout << "game " << games << " card " << state->curCard << " (" << state->cardsLeft << " left): logged move "
+             << (int)entry.chosenMove << " in " << entry.searchUs / 1000.0 << " ms, replay " << move << " in " << ms
+             << " ms" << (move != entry.chosenMove ? "  MISMATCH" : "") << endl;
+    }
+    if (tree != NULL) {
+        delete tree;
+    } else {
         delete state;
-        if (numGames >= 1000){
-            break;
+    }
+
+    auto percentile = [](vector<double> v, double p) {
+        if (v.empty()) return 0.0;
+        sort(v.begin(), v.end());
+        return v[min(v.size() - 1, (size_t)(p * (double)v.size()))];
+    };
+    cout << games << " games, " << decisions << " decisions, " << mismatches << " moves differ";
+    if (otherSetup > 0) cout << " (" << otherSetup << " games played with another setup)";
+    cout << endl;
+    cout << "search ms  logged p50 " << percentile(loggedMs, 0.5) << " p95 " << percentile(loggedMs, 0.95)
+         << " max " << percentile(loggedMs, 1.0) << " | replay p50 " << percentile(replayMs, 0.5)
+         << " p95 " << percentile(replayMs, 0.95) << " max " << percentile(replayMs, 1.0) << endl;
+    return mismatches == 0 ? 0 : 2;
+}
+
+// Maps a dataset chunk and summarises it.
+int datasetStats(const string &path) {
+    DatasetView view;
+    if (!view.open(path)) {
+        cerr << "Not a readable dataset chunk: " << path << endl;
+        return 1;
+    }
+    long long visits = 0;
+    double finalScores = 0;
+    int agree = 0;
+    for (size_t i = 0; i < view.count; i++) {
+        const SelfPlayRecord &record = view.records[i];
+        finalScores += record.finalScore;
+        int mostVisited = -1;
+        uint32_t best = 0;
+        for (int m = 0; m < record.numMoves; m++) {
+            visits += record.visits[m];
+            if (mostVisited < 0 || record.visits[m] > best) {
+                best = record.visits[m];
+                mostVisited = record.moves[m];
+            }
         }
+        if (mostVisited == record.chosenMove) agree++;
+    }
+    cout << view.count << " records, " << visits << " root visits";
+    if (view.count > 0) {
+        cout << ", mean final score " << finalScores / view.count
+             << ", chosen = most visited in " << 100.0 * agree / view.count << "%";
     }
+    cout << endl;
+    return 0;
+}
+
+// Card trace of a pipeline event, up to its delivery to the search stage.
+static CardTrace traceOf(const CardEvent &event) {
+    CardTrace trace;
+    trace.card = event.card;
+    trace.frame = event.meta.seq;
+    trace.confirmed = event.confirmed;
+    trace.firstCaptureUs = event.firstCaptureUs;
+    trace.captureStartUs = event.meta.captureStartUs;
+    trace.captureEndUs = event.meta.captureEndUs;
+    trace.convertEndUs = event.meta.convertEndUs;
+    trace.recogniseStartUs = event.recogniseStartUs;
+    trace.recogniseEndUs = event.recogniseEndUs;
+    trace.deliveredUs = event.deliveredUs;
+    return trace;
 }
 
+// Runs the capture -> recognition pipeline over the labelled corpus images
+// in `dir`, each delivered twice per pass, and checks that every card is
+// reported once and correctly. Reports frame throughput and the latency from
+// a frame's capture to its card reaching the search stage. With `iterations`
+// the search stage plays the cards as one long run of games, searching each
+// decision like the live loop does, so the traces cover the whole path
+// (replays capture flat out, so cards then queue behind the search).
+static int pipelineBench(const std::string &dir, int passes, int iterations, LatencyTracer &tracer) {
+    ImageReplaySource source(2, passes);
+    std::vector<std::string> paths;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".png") {
+            paths.push_back(entry.path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    std::vector<int> expected;
+    for (const std::string &path : paths) {
+        int rank, suit;
+        if (!parseCardLabel(std::filesystem::path(path).filename().string(), rank, suit)) continue;
+        if (!source.add(path)) {
+            cerr << "Failed to load image: " << path << "\n";
+            return 10;
+        }
+        expected.push_back(rank * 4 + suit);
+    }
+    if (expected.empty()) {
+        cerr << "No labelled images (test<rank><suit>.png) in " << dir << "\n";
+        return 11;
+    }
+
+    CardPipeline pipeline(source);
+    std::vector<int64_t> latencies;
+    int cards = 0, wrong = 0;
+    State * state = new State();
+    auto start = chrono::steady_clock::now();
+    pipeline.start();
+    CardEvent event;
+    while (!pipeline.finished()) {
+        if (!pipeline.waitCard(event, 100)) continue;
+        latencies.push_back(event.deliveredUs - event.meta.captureStartUs);
+        if (event.card != expected[cards % expected.size()]) wrong++;
+        cards++;
+        CardTrace trace = traceOf(event);
+        if (iterations > 0) {
+            const int value = State::cardValue(event.card / 4, event.card % 4);
+            if (state->isTerminal() || state->justUndid || state->left[value] == 0) {
+                delete state;
+                state = new State();
+                pipeline.newGame();
+            }
+            State * next = state->sampleState(event.card);
+            delete state;
+            state = next;
+            trace.searchStartUs = monotonicUs();
+            if (!state->isTerminal()) {
+                SearchTree *tree = MCTS(state, iterations);
+                state = new State(tree->chosenState());
+                delete tree;
+            }
+            trace.searchEndUs = monotonicUs();
+        }
+        tracer.add(trace);
+    }
+    pipeline.stop();
+    delete state;
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) -> int64_t {
+        return latencies.empty() ? 0 : latencies[min(latencies.size() - 1, (size_t)(p * latencies.size()))];
+    };
+    const long long frames = pipeline.framesCaptured();
+    cout << cards << " cards (" << wrong << " wrong) from " << frames << " frames in " << seconds << " s: "
+         << frames / seconds << " frames/s\n";
+    cout << "capture -> search stage latency: p50 " << percentile(0.50) << " us, p95 " << percentile(0.95)
+         << " us, p99 " << percentile(0.99) << " us\n";
+    tracer.printSummary(cout);
+    const int want = (int)expected.size() * passes;
+    return cards == want && wrong == 0 ? 0 : 1;
+}
 
 int main(int argc, char **argv) {
     auto hasArg = [&](const std::string &needle) -> bool {
@@ -1011,31 +2117,169 @@ int main(int argc, char **argv) {
         return false;
     };
 
+    auto argValue = [&](const std::string &name) -> const char * {
+        for (int i = 1; i + 1 < argc; i++) {
+            if (argv[i] != nullptr && std::string(argv[i]) == name) return argv[i + 1];
+        }
+        return nullptr;
+    };
+
+    // Size of the shared thread pool (default: one worker per hardware
+    // thread), optionally pinning each worker to a core.
+    ThreadPool::configure(argValue("--threads") ? max(1, atoi(argValue("--threads"))) : 0, hasArg("--pin"));
+
+    if (const char *weightsPath = argValue("--weights")) {
+        if (!SmartMoveWeights::defaults().load(weightsPath)) {
+            cerr << "Could not read smart-move weights from " << weightsPath << endl;
+            return 1;
+        }
+        cout << "Loaded smart-move weights from " << weightsPath << endl;
+    }
+
+    if (argc >= 2 && string(argv[1]) == "--calc-clearable") {
+        if (argc >= 3) clearablePath = argv[2];
+        calcClearable(true);
+        if (!writeClearable()) {
+            cerr << "Failed to write the clearability table to " << clearablePath << endl;
+            return 1;
+        }
+        cout << "written to " << clearablePath << endl;
+        return 0;
+    }
+
+    if (const char *path = argValue("--clearable")) {
+        clearablePath = path;
+        if (!readClearable()) {
+            cerr << "Could not read the clearability table " << clearablePath << endl;
+            return 1;
+        }
+        cout << "Loaded the clearability table from " << clearablePath << endl;
+    }
+
+    if (const char *maxNodes = argValue("--max-nodes")) {
+        maxTreeNodes = max(0LL, atoll(maxNodes));
+        cout << "Search tree limited to " << maxTreeNodes << " nodes" << endl;
+    }
+
+    if (const char *valuePath = argValue("--value")) {
+        if (!ValueFunction::active().load(valuePath)) {
+            cerr << "Could not read value weights from " << valuePath << endl;
+            return 1;
+        }
+        cout << "Loaded value weights from " << valuePath << endl;
+    }
+
+    // Per-card latency traces (pipeline bench and live play), viewable in
+    // chrome://tracing or Perfetto.
+    LatencyTracer tracer;
+    if (const char *tracePath = argValue("--trace")) {
+        if (!tracer.open(tracePath)) {
+            cerr << "Could not open the trace file " << tracePath << endl;
+            return 1;
+        }
+    }
+
+    if (const char *depth = argValue("--rollout-depth")) {
+        rolloutDepth = max(0, atoi(depth));
+        if (rolloutDepth > 0 && !ValueFunction::active().loaded) {
+            cerr << "--rollout-depth needs --value <file>" << endl;
+            return 1;
+        }
+    }
+
+    sequentialHalving = hasArg("--halving");
+    scheduleSearch = hasArg("--schedule");
+
+    if (argc >= 2 && string(argv[1]) == "--train-value") {
+        int games = (argc >= 3) ? max(10, atoi(argv[2])) : 20000;
+        string out = (argc >= 4) ? string(argv[3]) : string("value_weights.txt");
+        return trainValueFunction(games, out);
+    }
+
+    if (argc >= 2 && string(argv[1]) == "--tune") {
+        int iterations = (argc >= 3) ? max(1, atoi(argv[2])) : 200;
+        int games = (argc >= 4) ? max(1, atoi(argv[3])) : 2000;
+        string out = (argc >= 5) ? string(argv[4]) : string("smart_weights.txt");
+        return tuneSmartMoveWeights(iterations, games, out);
+    }
+
     if (hasArg("--test4")) {
         test4();
         return 0;
     }
 
+#ifdef __APPLE__
     if (argc >= 2 && string(argv[1]) == "--screenshot-test") {
         string out = (argc >= 3) ? string(argv[2]) : string("reflector.png");
         return screenshotTest(out);
     }
+#endif
 
     if (argc >= 2 && string(argv[1]) == "--frompixels-test") {
         string in = (argc >= 3) ? string(argv[2]) : string("test1.png");
         return fromPixelsTest(in);
     }
 
+    if (argc >= 2 && string(argv[1]) == "--recognition-bench") {
+        string dir = (argc >= 3) ? string(argv[2]) : string(".");
+        int passes = (argc >= 4) ? max(1, atoi(argv[3])) : 2000;
+        return recognitionBench(dir, passes);
+    }
+
+    if (argc >= 2 && string(argv[1]) == "--train-recognition") {
+        string dir = (argc >= 3) ? string(argv[2]) : string(".");
+        string out = (argc >= 4) ? string(argv[3]) : string("recognition_tree.h");
+        return trainRecognition(dir, out);
+    }
+
+    if (argc >= 2 && string(argv[1]) == "--pipeline-bench") {
+        string dir = (argc >= 3) ? string(argv[2]) : string(".");
+        int passes = (argc >= 4) ? max(1, atoi(argv[3])) : 200;
+        int iterations = (argc >= 5 && argv[4][0] != '-') ? max(0, atoi(argv[4])) : 0;
+        return pipelineBench(dir, passes, iterations, tracer);
+    }
+
+    if (argc >= 2 && string(argv[1]) == "--selfplay") {
+        int games = (argc >= 3) ? max(1, atoi(argv[2])) : 100;
+        int iterations = (argc >= 4) ? max(1, atoi(argv[3])) : 1000;
+        string dir = (argc >= 5) ? string(argv[4]) : string("selfplay");
+        return selfPlay(games, iterations, dir, argValue("--seed"));
+    }
+
+    if (const char *bookPath = argValue("--book")) {
+        if (!OpeningBook::active().load(bookPath)) {
+            cerr << "Could not read the opening book " << bookPath << endl;
+            return 1;
+        }
+        cout << "Loaded " << OpeningBook::active().entries.size() << " opening book positions from " << bookPath << endl;
+    }
+
+    if (argc >= 2 && string(argv[1]) == "--build-book") {
+        int decisions = (argc >= 3) ? max(1, atoi(argv[2])) : 3;
+        int iterations = (argc >= 4) ? max(1, atoi(argv[3])) : 1000000;
+        string out = (argc >= 5) ? string(argv[4]) : string("opening_book.bin");
+        return buildOpeningBook(decisions, iterations, out);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "--replay") {
+        return replayGameLog(argv[2]);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "--dataset-stats") {
+        return datasetStats(argv[2]);
+    }
+
     if (hasArg("simulate") || hasArg("--simulate")) {
         simulate();
         return 0;
     }
 
+#ifndef __APPLE__
+    cerr << "Live mode needs the macOS window capture; use simulate or the offline test modes." << endl;
+    return 1;
+#else
     //test3();
     //return 0;
-    //readClearable();
-    //calcClearable(false);
-    //writeClearable();
     overlay_start();
     overlay_set_text_size(64);
     overlay_set_text_color(1, 0, 0, 1);
@@ -1044,39 +2288,103 @@ int main(int argc, char **argv) {
     overlay_step(0.001);
     overlay_redraw();
     
-    srand(time(NULL));
+    // Every game is logged so that its searches can be replayed offline.
+    const char *logPath = argValue("--record");
+    GameLogWriter gameLog;
+    if (!gameLog.open(logPath != nullptr ? logPath : "live_games.log")) {
+        cerr << "Could not open the game log (or it is from another version); continuing without it" << endl;
+    }
+
+    // Capture and recognition run on their own threads; this thread searches
+    // and keeps the overlay responsive while it waits for the next card.
+    WindowCaptureSource capture;
+    CardPipeline pipeline(capture);
+    pipeline.start();
+
+    State::seedRandom((uint64_t)time(NULL));
+    const uint64_t setup = setupHash();
     long long hashcode = -1;
     bool printed = false;
     while(true){
         State * state = new State();
-        Node * root = NULL;
-        int prevCard = -1;
+        SearchTree * tree = NULL;
+        SearchBudget budget(kLiveIterations);
+        pipeline.newGame();
+        GameLogEntry start = {};
+        start.kind = GameLogEntry::kGameStart;
+        start.detectedAtUs = wallClockUs();
+        start.setup = setup;
+        gameLog.write(start);
         while(true){
-            State * newState = sampleFromScreenshot(root == NULL ? state : root->state, prevCard);
+            CardEvent card;
+            while (!pipeline.waitCard(card, 1)) {
+                overlay_step(0.001);
+                overlay_redraw();
+            }
+            CardTrace trace = traceOf(card);
+            windowX = card.meta.windowX;
+            windowY = card.meta.windowY;
+            windowW = card.meta.windowW;
+            windowH = card.meta.windowH;
+            cout << "detected " << card.card / 4 << " " << card.card % 4
+                 << " (confidence " << card.reading.confidence << (card.confirmed ? ", confirmed" : "") << ")" << endl;
+            State * newState = (tree == NULL ? state : tree->chosenState())->sampleState(card.card);
             newState->print();
 
-            prevCard = newState->curRank * 4 + newState->curSuit;
-            if (root != NULL){
-                delete root->parent;
+            GameLogEntry entry = {};
+            entry.kind = GameLogEntry::kCard;
+            entry.rank = (int8_t)newState->curRank;
+            entry.suit = (int8_t)newState->curSuit;
+            entry.chosenMove = -1;
+            entry.detectedAtUs = wallClockUs();
+            entry.iterations = kLiveIterations;
+            entry.seed = ((uint64_t)State::nextRandom() << 32) | State::nextRandom();
+            entry.rolloutDepth = rolloutDepth;
+            entry.maxTreeNodes = maxTreeNodes;
+            entry.flags = sequentialHalving ? GameLogEntry::kSequentialHalving : 0;
+
+            if (tree != NULL){
+                delete tree;
             } else {
                 delete state;
             }
             state = newState;
 
             if (state->isTerminal()){
+                gameLog.write(entry);
                 break;
             }
 
-            root = MCTS(state, 10000);
+            trace.searchStartUs = monotonicUs();
+            tree = bookMove(state);
+            if (tree != NULL) {
+                entry.iterations = 0; // replayed from the book
+                trace.fromBook = true;
+            } else {
+                if (scheduleSearch) {
+                    // Forced moves get no iterations, but 0 is logged for book moves.
+                    entry.iterations = (uint32_t)max(1, budget.iterationsFor(*state));
+                }
+                tree = searchLogged(state, entry);
+            }
+            trace.searchEndUs = monotonicUs();
+            entry.searchUs = (uint32_t)(trace.searchEndUs - trace.searchStartUs);
+            entry.chosenMove = (int8_t)chosenMove(tree);
+            gameLog.write(entry);
             cout << "best move: ";
-            if (root->state->justUndid){
+            if (tree->chosenState()->justUndid){
                 cout << "undo" << endl;
             } else {
-                cout << root->state->curMove << endl;
+                cout << tree->chosenState()->curMove << endl;
             }
-            root->state->showBestMove(windowX, windowY, windowW, windowH);
+            printTreeMemory();
+            trace.showStartUs = monotonicUs();
+            tree->chosenState()->showBestMove(windowX, windowY, windowW, windowH);
             overlay_step(0.001);
             overlay_redraw();
+            trace.redrawEndUs = monotonicUs();
+            tracer.add(trace);
+            if (tracer.cards() % 10 == 0) tracer.printSummary(cout);
         }
         overlay_step(0.001);
         overlay_redraw();
@@ -1084,4 +2392,5 @@ int main(int argc, char **argv) {
 
     }
     return 0;
+#endif
 }
\ No newline at end of file
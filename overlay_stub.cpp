@@ -0,0 +1,29 @@
+// Headless overlay for builds without AppKit (e.g. Linux). Every call is a
+// no-op so the engine, simulation and offline tools link unchanged.
+#include "overlay.h"
+
+extern "C" void overlay_start() {}
+extern "C" void overlay_redraw() {}
+extern "C" void overlay_stop() {}
+extern "C" void overlay_run() {}
+extern "C" void overlay_step(double) {}
+
+extern "C" void overlay_set_text_utf8(const char*) {}
+extern "C" void overlay_clear_text() {}
+extern "C" void overlay_set_text_size(double) {}
+extern "C" void overlay_set_text_color(double, double, double, double) {}
+extern "C" void overlay_set_text_position(double, double) {}
+
+extern "C" void overlay_label_set(const char*, const char*,
+                                  double, double, double,
+                                  double, double, double, double) {}
+extern "C" void overlay_label_remove(const char*) {}
+extern "C" void overlay_labels_clear() {}
+
+extern "C" void overlay_rect_set(const char*,
+                                 double, double, double, double,
+                                 double,
+                                 double, double, double, double,
+                                 double, double, double, double) {}
+extern "C" void overlay_rect_remove(const char*) {}
+extern "C" void overlay_rects_clear() {}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "frame.h"
+#include "state.h"
+
+// Live card pipeline. A frame source captures into the slots of a small ring
+// buffer on its own thread, a recognition thread reads each slot in place and
+// hands it back, and the search stage (the caller) is woken as soon as a
+// card is confirmed. Frames are never copied between stages; only slot
+// indices move.
+
+static inline int64_t monotonicUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// What a source knows about one capture besides its pixels.
+struct FrameMeta {
+    uint64_t seq = 0;
+    int64_t captureStartUs = 0; // monotonicUs()
+    int64_t captureEndUs = 0;
+    int64_t convertEndUs = 0;   // card region converted into the frame
+    // Window the frame was captured from, in screen points (for the overlay).
+    int windowX = 0;
+    int windowY = 0;
+    int windowW = 0;
+    int windowH = 0;
+};
+
+// Produces frames for the pipeline: the macOS window capture live, or image
+// files for replays and benchmarks.
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    // Fills `frame`, reusing its storage, with the next capture. Blocks until
+    // one is available (retrying a lost window, say); returns false once the
+    // source is exhausted.
+    virtual bool next(Frame &frame, FrameMeta &meta) = 0;
+
+    // Whether the pipeline should pace captures by the recognition stage's
+    // polling delay. Replays run flat out.
+    virtual bool live() const { return false; }
+};
+
+// Fixed set of frame slots cycling free -> filled by the source -> ready ->
+// read by recognition -> free. A live pipeline never waits for a slot: if
+// recognition falls behind, the oldest ready frame is dropped and refilled.
+class FrameRing {
+public:
+    static constexpr int kSlots = 4;
+
+    struct Slot {
+        Frame frame;
+        FrameMeta meta;
+    };
+
+    explicit FrameRing(bool dropStale) : dropStale(dropStale) {
+        for (int i = 0; i < kSlots; i++) freeSlots.push_back(i);
+    }
+
+    // Producer: a slot to fill, or NULL once closed.
+    Slot *acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (freeSlots.empty() && dropStale && !readySlots.empty()) {
+            freeSlots.push_back(readySlots.front());
+            readySlots.pop_front();
+            dropped++;
+        }
+        changed.wait(lock, [&] { return closed || !freeSlots.empty(); });
+        if (closed) return NULL;
+        const int index = freeSlots.front();
+        freeSlots.pop_front();
+        return &slots[index];
+    }
+
+    void publish(Slot *slot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            readySlots.push_back(indexOf(slot));
+        }
+        changed.notify_all();
+    }
+
+    // Consumer: the oldest filled slot, or NULL once closed and drained.
+    Slot *take() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return closed || !readySlots.empty(); });
+        if (readySlots.empty()) return NULL;
+        const int index = readySlots.front();
+        readySlots.pop_front();
+        return &slots[index];
+    }
+
+    // Either side gives a slot back unused / after reading it.
+    void release(Slot *slot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeSlots.push_back(indexOf(slot));
+        }
+        changed.notify_all();
+    }
+
+    // No more frames will be published; take() drains what is ready.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        changed.notify_all();
+    }
+
+    long long droppedFrames() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return dropped;
+    }
+
+private:
+    int indexOf(const Slot *slot) const { return (int)(slot - slots); }
+
+    Slot slots[kSlots];
+    std::deque<int> freeSlots;
+    std::deque<int> readySlots;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool dropStale;
+    bool closed = false;
+    long long dropped = 0;
+};
+
+// A confirmed card, as handed to the search stage.
+struct CardEvent {
+    int card = -1; // rank * 4 + suit
+    CardReading reading;
+    bool confirmed = false; // read twice rather than accepted on confidence
+    FrameMeta meta;         // of the frame it was read from
+    int64_t firstCaptureUs = 0; // capture start of the first frame showing the card
+    int64_t recogniseStartUs = 0;
+    int64_t recogniseEndUs = 0;
+    int64_t deliveredUs = 0; // taken by waitCard()
+};
+
+class CardPipeline {
+public:
+    // Readings at least this confident (see CardReading) are trusted without a
+    // confirming capture. Keep it above the highest confidence of a misread
+    // that --train-recognition reports for shifted probes (0.25 for the
+    // current trees).
+    static constexpr double kAcceptConfidence = 0.3;
+    static constexpr int kMinPollMs = 10;
+    static constexpr int kMaxPollMs = 160;
+
+    explicit CardPipeline(FrameSource &source)
+        : source(source), ring(source.live()) {}
+
+    ~CardPipeline() { stop(); }
+
+    CardPipeline(const CardPipeline &) = delete;
+    CardPipeline &operator=(const CardPipeline &) = delete;
+
+    void start() {
+        running = true;
+        recognitionThread = std::thread([this]() { recognitionLoop(); });
+        sourceThread = std::thread([this]() { sourceLoop(); });
+    }
+
+    void stop() {
+        running = false;
+        ring.close();
+        if (sourceThread.joinable()) sourceThread.join();
+        if (recognitionThread.joinable()) recognitionThread.join();
+    }
+
+    // Waits up to `timeoutMs` for the next card. False on timeout, or once the
+    // source is exhausted and every card has been delivered (see finished()).
+    bool waitCard(CardEvent &event, int timeoutMs) {
+        std::unique_lock<std::mutex> lock(eventMutex);
+        eventReady.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                            [&] { return !events.empty() || done; });
+        if (events.empty()) return false;
+        event = events.front();
+        events.pop_front();
+        event.deliveredUs = monotonicUs();
+        return true;
+    }
+
+    bool finished() {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        return done && events.empty();
+    }
+
+    // A new game starts: the first card may repeat the last one seen.
+    void newGame() { lastCard = -1; }
+
+    long long framesCaptured() const { return captured.load(); }
+    long long framesRecognised() const { return recognised.load(); }
+    long long framesDropped() { return ring.droppedFrames(); }
+
+private:
+    void sourceLoop() {
+        uint64_t seq = 0;
+        while (running) {
+            FrameRing::Slot *slot = ring.acquire();
+            if (slot == NULL) break;
+            slot->meta = FrameMeta();
+            if (!source.next(slot->frame, slot->meta)) {
+                ring.release(slot);
+                break;
+            }
+            slot->meta.seq = seq++;
+            captured++;
+            ring.publish(slot);
+            if (source.live()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(pollMs.load()));
+            }
+        }
+        ring.close();
+    }
+
+    // Detection only runs when the card region has changed. A confident
+    // reading is accepted from that single frame; an ambiguous one must be
+    // read again from a second, identical capture. While nothing changes the
+    // source backs off.
+    void recognitionLoop() {
+        State::resetCaptureTransform();
+        State base;
+        uint64_t settledHash = 0;
+        uint64_t pendingHash = 0;
+        int64_t pendingSinceUs = 0;
+        while (FrameRing::Slot *slot = ring.take()) {
+            recognised++;
+            const uint64_t hash = slot->frame.fingerprint();
+            if (hash == settledHash) {
+                ring.release(slot);
+                pollMs = std::min(pollMs.load() * 2, kMaxPollMs);
+                continue;
+            }
+            pollMs = kMinPollMs;
+            const bool stable = (hash == pendingHash);
+            pendingHash = hash;
+            if (!stable) pendingSinceUs = slot->meta.captureStartUs;
+
+            CardReading reading;
+            const int64_t recogniseStartUs = monotonicUs();
+            State * read = base.fromFrame(slot->frame, lastCard.load(), &reading);
+            const int64_t recogniseEndUs = monotonicUs();
+            const bool accept = read != NULL && (stable || reading.confidence >= kAcceptConfidence);
+            if (accept || stable) {
+                settledHash = hash;
+            }
+            if (accept) {
+                CardEvent event;
+                event.card = read->curRank * 4 + read->curSuit;
+                event.reading = reading;
+                event.confirmed = stable;
+                event.meta = slot->meta;
+                event.firstCaptureUs = pendingSinceUs;
+                event.recogniseStartUs = recogniseStartUs;
+                event.recogniseEndUs = recogniseEndUs;
+                lastCard = event.card;
+                {
+                    std::lock_guard<std::mutex> lock(eventMutex);
+                    events.push_back(event);
+                }
+                eventReady.notify_all();
+            }
+            delete read;
+            ring.release(slot);
+        }
+        {
+            std::lock_guard<std::mutex> lock(eventMutex);
+            done = true;
+        }
+        eventReady.notify_all();
+    }
+
+    FrameSource &source;
+    FrameRing ring;
+    std::thread sourceThread;
+    std::thread recognitionThread;
+    std::atomic<bool> running{false};
+    std::atomic<int> pollMs{kMinPollMs};
+    std::atomic<int> lastCard{-1};
+    std::atomic<long long> captured{0};
+    std::atomic<long long> recognised{0};
+
+    std::mutex eventMutex;
+    std::condition_variable eventReady;
+    std::deque<CardEvent> events;
+    bool done = false;
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Process-wide work-stealing thread pool, started on first use and shared by
+// the search, simulation, self-play, tuning and recognition modes.
+//
+// Every worker owns a deque: it pushes and pops its own tasks at the back and
+// steals from the front of the others' when it runs dry. Tasks submitted from
+// outside the pool are dealt round-robin. A worker that waits for a group
+// runs queued tasks meanwhile, so tasks may submit and wait for subtasks
+// (a self-play game waits for its searches) without tying up the pool. Such a
+// task can therefore run in the middle of another one on the same thread: a
+// task that changes thread-local state (the card RNG, the active smart-move
+// weights) restores it before returning.
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // Tasks that can be waited for together.
+    class Group {
+    public:
+        explicit Group(ThreadPool &pool = ThreadPool::global()) : pool(pool) {}
+
+        ~Group() { wait(); }
+
+        Group(const Group &) = delete;
+        Group &operator=(const Group &) = delete;
+
+        void run(Task task) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending++;
+            }
+            pool.submit([this, task = std::move(task)]() {
+                task();
+                // Before the waiter can wake and read the pool's statistics.
+                pool.settleBusyTime();
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--pending == 0) done.notify_all();
+            });
+        }
+
+        // Returns once every task run so far has finished. Workers help with
+        // queued tasks while they wait; other threads sleep.
+        void wait() {
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (pending == 0) return;
+                    if (currentWorker() < 0) {
+                        done.wait(lock, [&] { return pending == 0; });
+                        return;
+                    }
+                }
+                if (!pool.runQueued()) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    done.wait_for(lock, std::chrono::milliseconds(1), [&] { return pending == 0; });
+                }
+            }
+        }
+
+    private:
+        ThreadPool &pool;
+        std::mutex mutex;
+        std::condition_variable done;
+        int pending = 0;
+    };
+
+    // Worker count and pinning of the global pool (--threads, --pin); only
+    // takes effect before its first use. 0 workers means one per hardware
+    // thread.
+    static void configure(int workers, bool pin) {
+        configuredWorkers() = workers;
+        configuredPin() = pin;
+    }
+
+    static ThreadPool &global() {
+        static ThreadPool pool(configuredWorkers(), configuredPin());
+        return pool;
+    }
+
+    ThreadPool(int workers, bool pin)
+        : queues(workers > 0 ? workers : std::max(1u, std::thread::hardware_concurrency())),
+          counters(queues.size()), started(std::chrono::steady_clock::now()) {
+        for (int i = 0; i < (int)queues.size(); i++) {
+            threads.emplace_back([this, i, pin]() { workerLoop(i, pin); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : threads) thread.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size() const { return (int)threads.size(); }
+
+    // Index of the pool worker running this thread, or -1.
+    static int &currentWorker() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    // Credits the calling worker with the time its current task has run so
+    // far; runTask() adds only what comes after.
+    void settleBusyTime() {
+        const int index = currentWorker();
+        if (index < 0 || taskStart() == std::chrono::steady_clock::time_point()) return;
+        const auto now = std::chrono::steady_clock::now();
+        counters[index].busyNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now - taskStart()).count();
+        taskStart() = now;
+    }
+
+    void submit(Task task) {
+        int target = currentWorker();
+        if (target < 0) target = (int)(nextQueue.fetch_add(1) % queues.size());
+        {
+            std::lock_guard<std::mutex> lock(queues[target].mutex);
+            queues[target].tasks.push_back(std::move(task));
+        }
+        queued++;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    // Runs fn(i) for every i in [0, n) on the pool and waits, handing out
+    // indices one at a time to at most one task per worker.
+    void parallelFor(size_t n, const std::function<void(size_t)> &fn) {
+        std::atomic<size_t> next(0);
+        Group group(*this);
+        const int tasks = (int)std::min(n, (size_t)size());
+        for (int t = 0; t < tasks; t++) {
+            group.run([&]() {
+                size_t i;
+                while ((i = next.fetch_add(1)) < n) fn(i);
+            });
+        }
+        group.wait();
+    }
+
+    // Worker time spent running tasks over the pool's lifetime, and counts of
+    // tasks, steals and idle waits.
+    void printStats(std::ostream &out) const {
+        uint64_t tasks = 0, steals = 0, idleWaits = 0, busyNs = 0, idleNs = 0;
+        for (const Counters &c : counters) {
+            tasks += c.tasks.load();
+            steals += c.steals.load();
+            idleWaits += c.idleWaits.load();
+            busyNs += c.busyNs.load();
+            idleNs += c.idleNs.load();
+        }
+        const double lifetimeNs = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - started).count() * (double)size();
+        out << "pool: " << size() << " workers, " << tasks << " tasks (" << steals << " stolen), "
+            << "utilisation " << (lifetimeNs > 0 ? 100.0 * (double)busyNs / lifetimeNs : 0.0) << "%, "
+            << idleWaits << " idle waits (" << (double)idleNs / 1e9 << " s)" << std::endl;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> tasks{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> idleWaits{0};
+        std::atomic<uint64_t> busyNs{0};
+        std::atomic<uint64_t> idleNs{0};
+    };
+
+    static int &configuredWorkers() {
+        static int workers = 0;
+        return workers;
+    }
+
+    static bool &configuredPin() {
+        static bool pin = false;
+        return pin;
+    }
+
+    // Start of the busy time not yet credited for the worker's outermost
+    // task; unset between tasks.
+    static std::chrono::steady_clock::time_point &taskStart() {
+        static thread_local std::chrono::steady_clock::time_point start;
+        return start;
+    }
+
+    // Takes a task for worker `index`: the newest of its own, else the
+    // oldest of another worker's.
+    bool take(int index, Task &task) {
+        const int n = (int)queues.size();
+        for (int k = 0; k < n; k++) {
+            Queue &queue = queues[(index + k) % n];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            if (k == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                counters[index].steals++;
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void runTask(int index, Task &task) {
+        counters[index].tasks++;
+        taskStart() = std::chrono::steady_clock::now();
+        task();
+        settleBusyTime();
+        taskStart() = std::chrono::steady_clock::time_point();
+    }
+
+    // Runs one queued task on the calling worker; false if none was queued.
+    // The worker is already inside a task, whose busy time covers this one.
+    bool runQueued() {
+        const int index = currentWorker();
+        Task task;
+        if (index < 0 || !take(index, task)) return false;
+        counters[index].tasks++;
+        task();
+        return true;
+    }
+
+    void workerLoop(int index, bool pin) {
+        currentWorker() = index;
+#ifdef __linux__
+        if (pin) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(index % (int)std::max(1u, std::thread::hardware_concurrency()), &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+#else
+        (void)pin; // macOS has no hard affinity; workers float
+#endif
+        while (true) {
+            Task task;
+            if (take(index, task)) {
+                runTask(index, task);
+                continue;
+            }
+            const auto begin = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            if (stopping) return;
+            if (queued.load() == 0) {
+                counters[index].idleWaits++;
+                wake.wait(lock, [&] { return stopping || queued.load() > 0; });
+            }
+            counters[index].idleNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - begin).count();
+        }
+    }
+
+    std::vector<Queue> queues;
+    std::vector<Counters> counters;
+    std::vector<std::thread> threads;
+    std::atomic<long long> queued{0};
+    std::atomic<uint64_t> nextQueue{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::chrono::steady_clock::time_point started;
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <utility>
+
+// Pixel classification and probe trees used by State::fromPixels().
+//
+// Every rank probe is classified through one precomputed table instead of a
+// chain of RGB range tests. The colour rules below are the only place to
+// retune when the mirrored device's display profile changes: the per-channel
+// quantisation is derived from the rule edges, so the table stays exact.
+//
+// Which pixels to probe is learnt: `mcts --train-recognition` fits the rank
+// and suit trees of recognition_tree.h to the labelled screenshots. Retrain
+// after adding images or changing a colour rule.
+
+enum PixelClass : uint8_t {
+    PIXEL_OTHER = 0,
+    PIXEL_INK = 1,   // rank glyph ink (black, purple and red variants)
+    PIXEL_WHITE = 2, // card background
+};
+
+struct ColorRule {
+    // Inclusive channel ranges.
+    uint8_t rLo, rHi;
+    uint8_t gLo, gHi;
+    uint8_t bLo, bHi;
+    PixelClass cls;
+};
+
+static const ColorRule kColorRules[] = {
+    {  0,  94,   0,  94,   0,  94, PIXEL_INK },   // black
+    { 71,  99,  71,  99,  71,  99, PIXEL_INK },   // black
+    { 86, 109,  86, 109,  86, 109, PIXEL_INK },   // black
+    { 71, 109,   0,  39,  91, 119, PIXEL_INK },   // purple
+    {141, 255,   0,  59,   0,  79, PIXEL_INK },   // red
+    {131, 179,   0,  49,  11,  79, PIXEL_INK },   // red
+    {171, 219,   0,  44,  71, 119, PIXEL_INK },   // magenta
+    {171, 199,   0,  24,  21,  69, PIXEL_INK },   // dark red
+    {181, 255, 181, 255, 181, 255, PIXEL_WHITE }, // white
+};
+
+struct ColorTable {
+    static constexpr int kBucketBits = 5;
+    static constexpr int kMaxBuckets = 1 << kBucketBits;
+
+    // Per-channel bucket index, pre-shifted so that the table index is
+    // qr[r] | qg[g] | qb[b].
+    uint16_t qr[256];
+    uint16_t qg[256];
+    uint16_t qb[256];
+    uint8_t cls[kMaxBuckets * kMaxBuckets * kMaxBuckets];
+
+    ColorTable() {
+        uint8_t repR[kMaxBuckets], repG[kMaxBuckets], repB[kMaxBuckets];
+        quantise(0, qr, repR, 2 * kBucketBits);
+        quantise(1, qg, repG, kBucketBits);
+        quantise(2, qb, repB, 0);
+
+        // Classify each bucket by a representative value; all values in a
+        // bucket fall on the same side of every rule edge.
+        for (int i = 0; i < kMaxBuckets; i++) {
+            for (int j = 0; j < kMaxBuckets; j++) {
+                for (int k = 0; k < kMaxBuckets; k++) {
+                    cls[(i << (2 * kBucketBits)) | (j << kBucketBits) | k] =
+                        classifySlow(repR[i], repG[j], repB[k]);
+                }
+            }
+        }
+    }
+
+    inline uint8_t classify(uint8_t r, uint8_t g, uint8_t b) const {
+        return cls[qr[r] | qg[g] | qb[b]];
+    }
+
+    static uint8_t classifySlow(int r, int g, int b) {
+        for (const ColorRule &rule : kColorRules) {
+            if (r >= rule.rLo && r <= rule.rHi && g >= rule.gLo && g <= rule.gHi && b >= rule.bLo && b <= rule.bHi) {
+                return rule.cls;
+            }
+        }
+        return PIXEL_OTHER;
+    }
+
+private:
+    static void quantise(int channel, uint16_t out[256], uint8_t rep[kMaxBuckets], int shift) {
+        bool edge[257] = {false};
+        for (const ColorRule &rule : kColorRules) {
+            const int lo = channel == 0 ? rule.rLo : channel == 1 ? rule.gLo : rule.bLo;
+            const int hi = channel == 0 ? rule.rHi : channel == 1 ? rule.gHi : rule.bHi;
+            edge[lo] = true;
+            edge[hi + 1] = true;
+        }
+        int bucket = 0;
+        for (int v = 0; v < 256; v++) {
+            if (v > 0 && edge[v]) bucket++;
+            if (bucket >= kMaxBuckets) {
+                std::cerr << "ColorTable: too many rule edges on channel " << channel << std::endl;
+                std::abort();
+            }
+            if (v == 0 || edge[v]) rep[bucket] = (uint8_t)v;
+            out[v] = (uint16_t)(bucket << shift);
+        }
+        for (int i = bucket + 1; i < kMaxBuckets; i++) rep[i] = 255;
+    }
+};
+
+static inline const ColorTable &colorTable() {
+    static const ColorTable table;
+    return table;
+}
+
+// Classes read by the suit tree: the pip is red or black on white. The edges
+// are the ones the suit checks used before the tree was trained.
+enum SuitPixelClass : uint8_t {
+    SUIT_OTHER = 0,
+    SUIT_BLACK = 1,
+    SUIT_WHITE = 2,
+    SUIT_RED = 3,
+};
+
+static inline uint8_t suitPixelClass(uint8_t r, uint8_t g, uint8_t b) {
+    if (r > 180 && g < 60 && b < 60) return SUIT_RED;
+    if (r < 105 && g < 105 && b < 105) return SUIT_BLACK;
+    if (r >= 181 && g >= 181 && b >= 181) return SUIT_WHITE;
+    return SUIT_OTHER;
+}
+
+// Node of a probe decision tree (see recognition_tree.h): read the pixel at
+// reference (714x1056) coordinates (x, y), classify it, and follow next[class].
+// Chains of nodes with a single way on verify the label the tree arrived at.
+static constexpr int16_t kProbeReject = -1;
+static constexpr int16_t kProbeLeaf = -2; // next = kProbeLeaf - label
+
+struct ProbeNode {
+    int16_t x;
+    int16_t y;
+    int16_t next[4];      // per pixel class: node index, kProbeReject or a leaf
+    uint16_t classes[4];  // per pixel class: bit l set if label l showed it in training
+};
+
+// Walks `nodes` from the root, reading pixel classes with `classify(x, y)`.
+// Returns the label reached, or -1 if a pixel took a way training never saw.
+// `closest` receives the largest share of the probes read that some other
+// label (of `numLabels`) also showed in training.
+template <class Classify>
+static inline int walkProbeTree(const ProbeNode *nodes, int numLabels, Classify classify, double &closest) {
+    int matched[16] = {0};
+    int read = 0;
+    int at = 0;
+    while (at >= 0) {
+        const ProbeNode &node = nodes[at];
+        const uint8_t cls = classify(node.x, node.y);
+        const uint16_t seen = node.classes[cls & 3];
+        for (int l = 0; l < numLabels; l++) matched[l] += (seen >> l) & 1;
+        read++;
+        at = node.next[cls & 3];
+    }
+    closest = 0.0;
+    if (at == kProbeReject) return -1;
+    const int label = kProbeLeaf - at;
+    for (int l = 0; l < numLabels; l++) {
+        if (l != label) closest = std::max(closest, (double)matched[l] / (double)read);
+    }
+    return label;
+}
+
+// Result of one card detection. `confidence` is one minus the largest share
+// of a tree's probes read that another rank (or suit) also showed in
+// training: 1 when no other card came near, 0 when another would have read
+// the same.
+struct CardReading {
+    int rank = -1;
+    int suit = -1;
+    double confidence = 0.0;
+};
+
+#include "recognition_tree.h"
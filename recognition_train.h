@@ -0,0 +1,356 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "frame.h"
+#include "state.h"
+
+// Learns the probe trees of recognition_tree.h from labelled card images
+// (--train-recognition). Every pixel of the card region is a candidate probe.
+// A probe only counts for an image if the pixel and its neighbours within a
+// few source pixels all fall in the same class, so that the trees do not hang
+// on edges a slightly different capture would move. Splits are chosen
+// greedily by information gain, preferring probes that are stable over a
+// wider neighbourhood; every leaf is then guarded by a few probes that its
+// label always shows and most other labels do not.
+class ProbeTreeTrainer {
+public:
+    static constexpr int kMaxRadius = 2;  // neighbourhood (source pixels) a probe is tested over
+    static constexpr int kRankChecks = 3; // verification probes per leaf
+    static constexpr int kSuitChecks = 2;
+
+    struct Sample {
+        Frame frame;
+        int rank;
+        int suit;
+        std::string name;
+    };
+
+    struct Tree {
+        std::vector<ProbeNode> nodes;
+        int numLabels = 0;
+    };
+
+    explicit ProbeTreeTrainer(const std::vector<Sample> &samples) : samples(samples) {}
+
+    bool trainRanks(Tree &tree, std::string &error) {
+        const ColorTable &colors = colorTable();
+        useCandidates(false);
+        measure([&](const uint8_t *p) -> uint8_t { return colors.classify(p[2], p[1], p[0]); });
+        std::vector<int> labels;
+        for (const Sample &sample : samples) labels.push_back(sample.rank);
+        return train(labels, 13, kRankChecks, tree, error);
+    }
+
+    bool trainSuits(Tree &tree, std::string &error) {
+        useCandidates(true);
+        measure([](const uint8_t *p) -> uint8_t { return suitPixelClass(p[2], p[1], p[0]); });
+        std::vector<int> labels;
+        for (const Sample &sample : samples) labels.push_back(sample.suit);
+        return train(labels, 4, kSuitChecks, tree, error);
+    }
+
+    // How many samples the trees read correctly with every probe shifted by
+    // (dx, dy) source pixels, as a slightly misaligned capture would. Raises
+    // `misreadConfidence` to the highest confidence (as in State::fromFrame())
+    // of a wrong reading.
+    int check(const Tree &ranks, const Tree &suits, int dx, int dy, double &misreadConfidence) const {
+        const ColorTable &colors = colorTable();
+        State::setCaptureTransform(-dx, -dy, 1.0, 1.0);
+        int correct = 0;
+        for (const Sample &sample : samples) {
+            double suitClosest, rankClosest;
+            const int suit = walkProbeTree(suits.nodes.data(), 4, [&](int x, int y) -> uint8_t {
+                const uint8_t *p = State::probePixel(sample.frame, x, y);
+                return p != nullptr ? suitPixelClass(p[2], p[1], p[0]) : (uint8_t)SUIT_OTHER;
+            }, suitClosest);
+            const int rank = walkProbeTree(ranks.nodes.data(), 13, [&](int x, int y) -> uint8_t {
+                const uint8_t *p = State::probePixel(sample.frame, x, y);
+                return p != nullptr ? colors.classify(p[2], p[1], p[0]) : (uint8_t)PIXEL_OTHER;
+            }, rankClosest);
+            if (rank == sample.rank && suit == sample.suit) {
+                correct++;
+            } else if (rank >= 0 && suit >= 0) {
+                misreadConfidence = std::max(misreadConfidence, 1.0 - std::max(rankClosest, suitClosest));
+            }
+        }
+        State::resetCaptureTransform();
+        return correct;
+    }
+
+    // Emits both trees as recognition_tree.h.
+    static bool write(const std::string &path, const Tree &ranks, const Tree &suits, size_t images) {
+        std::ofstream out(path);
+        if (!out) return false;
+        out << "#pragma once\n\n"
+            << "// Generated by `mcts --train-recognition` from " << images << " labelled card images\n"
+            << "// (test<rank><suit>.png). Retrain rather than edit; see recognition.h.\n\n";
+        writeTree(out, "kRankTree", ranks);
+        out << "\n";
+        writeTree(out, "kSuitTree", suits);
+        return (bool)out;
+    }
+
+private:
+    static constexpr int kMargin = 3;  // keep probes (and their neighbourhoods) inside the card region
+    static constexpr int kSpacing = 4; // minimum distance between the probes guarding a leaf
+
+    // The suit pip of the corner index. The suit tree only probes inside it
+    // and the rank tree only outside, so that neither learns the other's
+    // label from the handful of cards each corpus image happens to show.
+    static constexpr int kPipLeft = 450;
+    static constexpr int kPipTop = 739;
+    static constexpr int kPipRight = 484;
+    static constexpr int kPipBottom = 764;
+
+    void useCandidates(bool pip) {
+        candidates.clear();
+        for (int y = kCardRoiTop + kMargin; y <= kCardRoiBottom - kMargin; y++) {
+            for (int x = kCardRoiLeft + kMargin; x <= kCardRoiRight - kMargin; x++) {
+                const bool inPip = x >= kPipLeft && x <= kPipRight && y >= kPipTop && y <= kPipBottom;
+                if (inPip == pip) candidates.push_back(std::make_pair(x, y));
+            }
+        }
+    }
+
+    bool near(int a, const std::vector<int> &probes) const {
+        for (int b : probes) {
+            if (std::max(std::abs(candidates[a].first - candidates[b].first),
+                         std::abs(candidates[a].second - candidates[b].second)) < kSpacing) return true;
+        }
+        return false;
+    }
+
+    // Class of every candidate in every sample, the radius over which it
+    // holds (-1: unreadable or OTHER), and how many of the shifts by up to
+    // kMaxRadius pixels keep it.
+    template <class Classify>
+    void measure(Classify classify) {
+        cls.assign(samples.size(), std::vector<uint8_t>(candidates.size(), 0));
+        radius.assign(samples.size(), std::vector<int8_t>(candidates.size(), -1));
+        shiftsKept.assign(samples.size(), std::vector<uint8_t>(candidates.size(), 0));
+        State::resetCaptureTransform();
+        for (size_t s = 0; s < samples.size(); s++) {
+            const Frame &frame = samples[s].frame;
+            for (size_t c = 0; c < candidates.size(); c++) {
+                int px, py;
+                State::mapToSource(frame.sourceWidth, frame.sourceHeight, candidates[c].first, candidates[c].second, px, py);
+                const uint8_t *centre = frame.pixel(px, py);
+                if (centre == nullptr) continue;
+                const uint8_t k = classify(centre);
+                cls[s][c] = k;
+                if (k == 0) continue;
+                int r = 0;
+                int kept = 0;
+                for (int d = 1; d <= kMaxRadius; d++) {
+                    bool same = true;
+                    for (int dy = -d; dy <= d; dy++) {
+                        for (int dx = -d; dx <= d; dx++) {
+                            if (std::max(std::abs(dx), std::abs(dy)) != d) continue;
+                            const uint8_t *p = frame.pixel(px + dx, py + dy);
+                            if (p != nullptr && classify(p) == k) {
+                                kept++;
+                            } else {
+                                same = false;
+                            }
+                        }
+                    }
+                    if (same && r == d - 1) r = d;
+                }
+                radius[s][c] = (int8_t)r;
+                shiftsKept[s][c] = (uint8_t)kept;
+            }
+        }
+    }
+
+    bool train(const std::vector<int> &labels, int numLabels, int checks, Tree &tree, std::string &error) {
+        tree.nodes.clear();
+        tree.numLabels = numLabels;
+        std::vector<int> all;
+        for (size_t s = 0; s < samples.size(); s++) all.push_back((int)s);
+        std::vector<int> path;
+        // The walk starts at node 0, which a split always is.
+        return build(labels, numLabels, checks, all, path, tree, error) == 0;
+    }
+
+    static double entropy(const std::vector<int> &counts, int total) {
+        double h = 0.0;
+        for (int n : counts) {
+            if (n > 0) h -= (double)n / total * std::log2((double)n / total);
+        }
+        return h;
+    }
+
+    ProbeNode newNode(int candidate, const std::vector<int> &labels) const {
+        ProbeNode node;
+        node.x = (int16_t)candidates[candidate].first;
+        node.y = (int16_t)candidates[candidate].second;
+        for (int k = 0; k < 4; k++) {
+            node.next[k] = kProbeReject;
+            node.classes[k] = 0;
+        }
+        for (size_t s = 0; s < samples.size(); s++) {
+            node.classes[cls[s][candidate] & 3] |= (uint16_t)(1u << labels[s]);
+        }
+        return node;
+    }
+
+    // Appends the subtree for `subset` and returns its root: a node index, or
+    // a leaf if no node was needed. Returns kProbeReject and sets `error` if
+    // two labels cannot be told apart.
+    int build(const std::vector<int> &labels, int numLabels, int checks, const std::vector<int> &subset,
+              std::vector<int> &path, Tree &tree, std::string &error) {
+        bool pure = true;
+        for (int s : subset) pure = pure && labels[s] == labels[subset[0]];
+        if (pure) return guardLeaf(labels, labels[subset[0]], checks, path, tree);
+
+        std::vector<int> counts(numLabels, 0);
+        for (int s : subset) counts[labels[s]]++;
+        const double before = entropy(counts, (int)subset.size());
+
+        // The widest radius any split holds over, then the most information,
+        // then the most shifts kept.
+        int best = -1;
+        double bestGain = 0.0;
+        int bestKept = -1;
+        for (int minRadius = kMaxRadius; minRadius >= 0 && best < 0; minRadius--) {
+            for (size_t c = 0; c < candidates.size(); c++) {
+                int kept = 255;
+                std::vector<int> byClass[4];
+                bool usable = true;
+                for (int s : subset) {
+                    if (radius[s][c] < minRadius) {
+                        usable = false;
+                        break;
+                    }
+                    kept = std::min(kept, (int)shiftsKept[s][c]);
+                    byClass[cls[s][c] & 3].push_back(s);
+                }
+                if (!usable) continue;
+                double after = 0.0;
+                int branches = 0;
+                for (int k = 0; k < 4; k++) {
+                    if (byClass[k].empty()) continue;
+                    branches++;
+                    std::vector<int> part(numLabels, 0);
+                    for (int s : byClass[k]) part[labels[s]]++;
+                    after += (double)byClass[k].size() / subset.size() * entropy(part, (int)byClass[k].size());
+                }
+                if (branches < 2) continue;
+                const double gain = before - after;
+                if (gain > bestGain + 1e-9 || (gain > bestGain - 1e-9 && kept > bestKept)) {
+                    best = (int)c;
+                    bestGain = gain;
+                    bestKept = kept;
+                }
+            }
+        }
+        if (best < 0) {
+            error = "no probe separates";
+            for (int s : subset) error += " " + samples[s].name;
+            return kProbeReject;
+        }
+
+        const int index = (int)tree.nodes.size();
+        tree.nodes.push_back(newNode(best, labels));
+        path.push_back(best);
+        for (int k = 0; k < 4; k++) {
+            std::vector<int> part;
+            for (int s : subset) {
+                if ((cls[s][best] & 3) == k) part.push_back(s);
+            }
+            if (part.empty()) continue;
+            const int child = build(labels, numLabels, checks, part, path, tree, error);
+            if (child == kProbeReject) return kProbeReject;
+            tree.nodes[index].next[k] = (int16_t)child;
+        }
+        path.pop_back();
+        return index;
+    }
+
+    // A chain of up to `checks` probes that every sample of `label` shows
+    // stably and most other labels do not, ending in the leaf.
+    int guardLeaf(const std::vector<int> &labels, int label, int checks, const std::vector<int> &path, Tree &tree) {
+        std::vector<int> chosen;
+        std::vector<int> contradicted(16, 0);
+        for (int n = 0; n < checks; n++) {
+            int best = -1;
+            double bestScore = 0.0;
+            for (size_t c = 0; c < candidates.size(); c++) {
+                if (near((int)c, path) || near((int)c, chosen)) continue;
+                int expected = -1;
+                bool stable = true;
+                for (size_t s = 0; s < samples.size() && stable; s++) {
+                    if (labels[s] != label) continue;
+                    if (radius[s][c] < kMaxRadius || (expected >= 0 && cls[s][c] != expected)) stable = false;
+                    expected = cls[s][c];
+                }
+                if (!stable || expected < 0) continue;
+                // Other labels whose every sample reads another class here.
+                double score = 0.0;
+                for (int other = 0; other < 16; other++) {
+                    if (other == label) continue;
+                    bool any = false, differs = true;
+                    for (size_t s = 0; s < samples.size() && differs; s++) {
+                        if (labels[s] != other) continue;
+                        any = true;
+                        differs = cls[s][c] != expected;
+                    }
+                    if (any && differs) score += 1.0 / (1 + contradicted[other]);
+                }
+                if (score > bestScore + 1e-9) {
+                    best = (int)c;
+                    bestScore = score;
+                }
+            }
+            if (best < 0) break;
+            chosen.push_back(best);
+            for (int other = 0; other < 16; other++) {
+                bool any = false, differs = true;
+                for (size_t s = 0; s < samples.size() && differs; s++) {
+                    if (labels[s] != other) continue;
+                    any = true;
+                    differs = cls[s][best] != cls[firstOf(labels, label)][best];
+                }
+                if (any && differs) contradicted[other]++;
+            }
+        }
+
+        int next = kProbeLeaf - label;
+        for (int n = (int)chosen.size() - 1; n >= 0; n--) {
+            ProbeNode node = newNode(chosen[n], labels);
+            node.next[cls[firstOf(labels, label)][chosen[n]] & 3] = (int16_t)next;
+            next = (int)tree.nodes.size();
+            tree.nodes.push_back(node);
+        }
+        return next;
+    }
+
+    int firstOf(const std::vector<int> &labels, int label) const {
+        for (size_t s = 0; s < labels.size(); s++) {
+            if (labels[s] == label) return (int)s;
+        }
+        return 0;
+    }
+
+    static void writeTree(std::ostream &out, const char *name, const Tree &tree) {
+        out << "static const ProbeNode " << name << "[] = {\n";
+        for (size_t i = 0; i < tree.nodes.size(); i++) {
+            const ProbeNode &n = tree.nodes[i];
+            out << "    {" << n.x << ", " << n.y << ", {" << n.next[0] << ", " << n.next[1] << ", " << n.next[2]
+                << ", " << n.next[3] << "}, {" << n.classes[0] << ", " << n.classes[1] << ", " << n.classes[2]
+                << ", " << n.classes[3] << "}}, // " << i << "\n";
+        }
+        out << "};\n";
+    }
+
+    const std::vector<Sample> &samples;
+    std::vector<std::pair<int, int>> candidates;
+    std::vector<std::vector<uint8_t>> cls;
+    std::vector<std::vector<int8_t>> radius;
+    std::vector<std::vector<uint8_t>> shiftsKept;
+};
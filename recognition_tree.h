@@ -0,0 +1,72 @@
+#pragma once
+
+// Generated by `mcts --train-recognition` from 15 labelled card images
+// (test<rank><suit>.png). Retrain rather than edit; see recognition.h.
+
+static const ProbeNode kRankTree[] = {
+    {421, 817, {-1, 1, 32, -1}, {0, 7849, 342, 0}}, // 0
+    {440, 806, {-1, 2, 17, -1}, {0, 5108, 3083, 0}}, // 1
+    {437, 781, {-1, 3, 10, -1}, {0, 2559, 5632, 0}}, // 2
+    {460, 797, {-1, 6, 9, -1}, {64, 3462, 4665, 0}}, // 3
+    {432, 803, {-1, -9, -1, -1}, {4098, 441, 3652, 0}}, // 4
+    {460, 793, {-1, 4, -1, -1}, {544, 3526, 4121, 0}}, // 5
+    {433, 814, {-1, 5, -1, -1}, {16, 4513, 3662, 0}}, // 6
+    {446, 798, {-1, -1, -7, -1}, {1284, 4683, 2224, 0}}, // 7
+    {434, 814, {-1, 7, -1, -1}, {81, 4512, 3598, 0}}, // 8
+    {405, 752, {-1, 8, -1, -1}, {393, 6192, 1606, 0}}, // 9
+    {468, 786, {-1, 13, 16, -1}, {0, 512, 7679, 0}}, // 10
+    {409, 790, {-1, -11, -1, -1}, {0, 512, 7679, 0}}, // 11
+    {413, 788, {-1, 11, -1, -1}, {0, 512, 7679, 0}}, // 12
+    {423, 761, {-1, 12, -1, -1}, {4097, 512, 3582, 0}}, // 13
+    {417, 781, {-1, -14, -1, -1}, {512, 4160, 3519, 0}}, // 14
+    {412, 739, {-1, -1, 14, -1}, {3071, 0, 5120, 0}}, // 15
+    {437, 827, {-1, -1, 15, -1}, {649, 3446, 4096, 0}}, // 16
+    {432, 782, {-1, 18, 25, -1}, {4096, 2551, 1544, 0}}, // 17
+    {412, 761, {-1, 21, 24, -1}, {0, 4086, 4105, 0}}, // 18
+    {446, 802, {-1, -1, -13, -1}, {1314, 4829, 2048, 0}}, // 19
+    {421, 753, {-1, 19, -1, -1}, {513, 2048, 5630, 0}}, // 20
+    {421, 749, {-1, 20, -1, -1}, {512, 2048, 5631, 0}}, // 21
+    {458, 790, {-1, -1, -2, -1}, {0, 8190, 1, 0}}, // 22
+    {457, 786, {-1, -1, 22, -1}, {0, 8190, 1, 0}}, // 23
+    {455, 782, {-1, -1, 23, -1}, {256, 7934, 1, 0}}, // 24
+    {409, 761, {-1, 28, 31, -1}, {0, 8182, 9, 0}}, // 25
+    {431, 790, {-1, -1, -12, -1}, {520, 6647, 1024, 0}}, // 26
+    {443, 789, {-1, -1, 26, -1}, {0, 7167, 1024, 0}}, // 27
+    {409, 743, {-1, -1, 27, -1}, {8, 7159, 1024, 0}}, // 28
+    {436, 795, {-1, -5, -1, -1}, {544, 9, 7638, 0}}, // 29
+    {428, 782, {-1, -1, 29, -1}, {33, 7158, 1032, 0}}, // 30
+    {430, 830, {-1, -1, 30, -1}, {65, 8118, 8, 0}}, // 31
+    {458, 817, {-1, 33, 44, -1}, {0, 7613, 578, 0}}, // 32
+    {449, 795, {-1, 34, 43, -1}, {0, 8175, 16, 0}}, // 33
+    {419, 798, {-1, 37, 40, -1}, {0, 7074, 1117, 0}}, // 34
+    {460, 804, {-1, -10, -1, -1}, {128, 3330, 4733, 0}}, // 35
+    {434, 814, {-1, 35, -1, -1}, {81, 4512, 3598, 0}}, // 36
+    {460, 808, {-1, 36, -1, -1}, {51, 3328, 4812, 0}}, // 37
+    {429, 802, {-1, -1, -4, -1}, {0, 7099, 1092, 0}}, // 38
+    {426, 812, {-1, -1, 38, -1}, {1024, 7097, 70, 0}}, // 39
+    {425, 800, {-1, -1, 39, -1}, {8, 7091, 1092, 0}}, // 40
+    {425, 781, {-1, -6, -1, -1}, {2436, 4688, 1067, 0}}, // 41
+    {439, 815, {-1, -1, 41, -1}, {141, 4930, 3120, 0}}, // 42
+    {453, 795, {-1, -1, 42, -1}, {0, 7663, 528, 0}}, // 43
+    {420, 781, {-1, 47, 50, -1}, {0, 4672, 3519, 0}}, // 44
+    {423, 825, {-1, -1, -8, -1}, {274, 7853, 64, 0}}, // 45
+    {427, 823, {-1, -1, 45, -1}, {256, 7871, 64, 0}}, // 46
+    {418, 758, {-1, -1, 46, -1}, {2, 8125, 64, 0}}, // 47
+    {461, 834, {-1, -3, -1, -1}, {128, 4611, 3452, 0}}, // 48
+    {451, 823, {-1, -1, 48, -1}, {0, 8125, 66, 0}}, // 49
+    {461, 822, {-1, -1, 49, -1}, {4608, 3517, 66, 0}}, // 50
+};
+
+static const ProbeNode kSuitTree[] = {
+    {467, 747, {-1, 1, -1, 6}, {0, 12, 0, 3}}, // 0
+    {460, 746, {-1, 3, 5, -1}, {0, 8, 6, 1}}, // 1
+    {465, 755, {-1, -5, -1, -1}, {4, 8, 0, 3}}, // 2
+    {471, 747, {-1, 2, -1, -1}, {4, 8, 0, 3}}, // 3
+    {470, 743, {-1, -4, -1, -1}, {0, 12, 0, 3}}, // 4
+    {466, 742, {-1, 4, -1, -1}, {1, 12, 0, 2}}, // 5
+    {459, 744, {-1, -1, 8, 10}, {0, 0, 14, 1}}, // 6
+    {459, 739, {-1, -1, -3, -1}, {1, 0, 14, 0}}, // 7
+    {471, 749, {-1, -1, -1, 7}, {4, 8, 0, 3}}, // 8
+    {463, 745, {-1, -1, -1, -2}, {2, 12, 0, 1}}, // 9
+    {474, 743, {-1, -1, -1, 9}, {0, 0, 14, 1}}, // 10
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+// Game rules as compile-time constants. State is BasicState<GAME_RULES>, so
+// pile loops, deck composition and scoring fold into the build of one
+// variant; choose another with -DGAME_RULES=<rules> (see compile.txt).
+//
+// A deck holds two wild black jacks (value 0), four cards of each value 1-9
+// and the other fourteen 10/J/Q/K (value 10); a shoe is `Decks` of them.
+// Card values stay 0-10 in every variant.
+template <int Decks, int Piles>
+struct ClassicRules {
+    static constexpr int kDecks = Decks;
+    static constexpr int kPiles = Piles;
+    static constexpr int kDeckSize = 52 * Decks;
+
+    static constexpr int cardsOfValue(int value) {
+        return Decks * (value == 0 ? 2 : value == 10 ? 14 : 4);
+    }
+
+    // A pile that reaches this many cards without busting clears.
+    static constexpr int kClearCards = 5;
+
+    // Clearing on streak s (0-kMaxStreak) first scores kStreakBonus[s].
+    static constexpr int kMaxStreak = 5;
+    static constexpr int kStreakBonus[kMaxStreak + 1] = {0, 25, 50, 75, 100, 125};
+
+    static constexpr int kWildBonus = 20;       // clearing with a wild
+    static constexpr int kFullPileBonus = 60;   // clearing kClearCards cards (a wild counts as one)
+    static constexpr int kTwentyOneBonus = 40;  // clearing on 21 (a wild on a pile of 11 or 1)
+    static constexpr int kNoBustBonus = 10;     // finishing without a bust
+    static constexpr int kAllClearBonus = 100;  // ... and with every pile empty
+    static constexpr int kUndoCost = 1;         // points taken by each undo
+};
+
+using StandardRules = ClassicRules<1, 4>;
+using TwoDeckRules = ClassicRules<2, 4>;
+using FivePileRules = ClassicRules<1, 5>;
+
+#ifndef GAME_RULES
+#define GAME_RULES StandardRules
+#endif
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// Constants of the rollout evaluation in State::makeSmartMove(). The defaults
+// are the hand-tuned values from the runs recorded in `results`; `--tune`
+// searches this space and writes the result in the format read by load().
+struct SmartMoveWeights {
+    // Pile choice evaluation.
+    double clearOutWeight = 2.6;       // per remaining card that clears some pile next
+    double distinctClearWeight = 6.0;  // per distinct card value that clears some pile next
+    double clearChanceWeight = 80.0;   // per pile, times its chance to clear soon (clearability table)
+    double bustRiskWeight = 0.0;       // per pile, times its chance to bust soon (clearability table)
+    double emptyPileBonus = 8.0;       // +/- for having an empty pile afterwards
+    double danger20Penalty = 18.0;     // per pile left on 20
+    double danger19Penalty = 10.0;     // per pile left on 19
+    double danger18Penalty = 4.0;      // per pile left on 18
+    double firstBustPenalty = 70.0;    // busting when we have not busted yet
+    double repeatBustPenalty = 12.0;   // busting again
+    double lateBustPenalty = 20.0;     // extra bust penalty with <= 12 cards left
+    double nextStreakWeight = 10.0;    // per streak level after the move
+
+    // Undo evaluation.
+    double undoFirstBustBonus = 85.0;  // undo removes the first bust
+    double undoStreakRestore = 10.0;   // per streak level undo restores
+    double undoSeqStreakWeight = 6.0;  // per streak level within the 2-card sequence
+    double undoStep2Weight = 0.85;     // weight of the known second card
+    double undoEmptyPileBonus = 3.0;   // +/- for an empty pile after the first card
+    double lateUndoPenalty = 25.0;     // undoing with <= 6 cards left (unless fixing a bust)
+
+    struct Field {
+        const char *name;
+        double SmartMoveWeights::*member;
+    };
+
+    static const Field *fields(size_t &count) {
+        static const Field kFields[] = {
+            {"clearOutWeight", &SmartMoveWeights::clearOutWeight},
+            {"distinctClearWeight", &SmartMoveWeights::distinctClearWeight},
+            {"clearChanceWeight", &SmartMoveWeights::clearChanceWeight},
+            {"bustRiskWeight", &SmartMoveWeights::bustRiskWeight},
+            {"emptyPileBonus", &SmartMoveWeights::emptyPileBonus},
+            {"danger20Penalty", &SmartMoveWeights::danger20Penalty},
+            {"danger19Penalty", &SmartMoveWeights::danger19Penalty},
+            {"danger18Penalty", &SmartMoveWeights::danger18Penalty},
+            {"firstBustPenalty", &SmartMoveWeights::firstBustPenalty},
+            {"repeatBustPenalty", &SmartMoveWeights::repeatBustPenalty},
+            {"lateBustPenalty", &SmartMoveWeights::lateBustPenalty},
+            {"nextStreakWeight", &SmartMoveWeights::nextStreakWeight},
+            {"undoFirstBustBonus", &SmartMoveWeights::undoFirstBustBonus},
+            {"undoStreakRestore", &SmartMoveWeights::undoStreakRestore},
+            {"undoSeqStreakWeight", &SmartMoveWeights::undoSeqStreakWeight},
+            {"undoStep2Weight", &SmartMoveWeights::undoStep2Weight},
+            {"undoEmptyPileBonus", &SmartMoveWeights::undoEmptyPileBonus},
+            {"lateUndoPenalty", &SmartMoveWeights::lateUndoPenalty},
+        };
+        count = sizeof(kFields) / sizeof(kFields[0]);
+        return kFields;
+    }
+
+    // Reads "name value" lines; unknown names are reported and skipped, and
+    // missing names keep their current value.
+    bool load(const std::string &path) {
+        std::ifstream in(path);
+        if (!in) return false;
+        size_t count = 0;
+        const Field *all = fields(count);
+        std::string name;
+        double value;
+        while (in >> name >> value) {
+            bool found = false;
+            for (size_t i = 0; i < count; i++) {
+                if (name == all[i].name) {
+                    this->*all[i].member = value;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                std::cerr << "Unknown smart-move weight '" << name << "' in " << path << std::endl;
+            }
+        }
+        return true;
+    }
+
+    bool save(const std::string &path) const {
+        std::ofstream out(path);
+        if (!out) return false;
+        write(out);
+        return (bool)out;
+    }
+
+    void write(std::ostream &out) const {
+        size_t count = 0;
+        const Field *all = fields(count);
+        for (size_t i = 0; i < count; i++) {
+            out << all[i].name << " " << this->*all[i].member << "\n";
+        }
+    }
+
+    // Weights used by makeSmartMove() on this thread. Threads start on the
+    // process-wide defaults; the tuner points workers at candidate sets.
+    static SmartMoveWeights &defaults() {
+        static SmartMoveWeights weights;
+        return weights;
+    }
+
+    static const SmartMoveWeights *&active() {
+        static thread_local const SmartMoveWeights *weights = &defaults();
+        return weights;
+    }
+};
@@ -5,11 +5,21 @@
 #include <cstdlib>
 #include <cmath>
 #include <utility>
+#include <cstdint>
 #include "overlay.h"
+#include "frame.h"
+#include "recognition.h"
+#include "smart_weights.h"
+#include "rules.h"
+#include "clearable.h"
 
 using namespace std;
 
-struct State {
+template <class Rules>
+struct BasicState {
+    using State = BasicState;
+    static constexpr int kPiles = Rules::kPiles;
+
     // When sampling from screen/window captures, `fromPixels()` uses hardcoded
     // screen-space coordinates (x,y). These thread-local parameters allow callers
     // to map those coordinates into the coordinate system of the provided pixel
@@ -30,9 +40,30 @@ struct State {
         setCaptureTransform(0.0, 0.0, 1.0, 1.0);
     }
 
-    int totals[4];
-    int numCards[4];
-    bool soft[4];
+    // Per-thread random source for card draws, so that games and searches can
+    // be replayed from a seed and run in parallel without sharing rand().
+    static inline thread_local uint64_t rngState = 0x9E3779B97F4A7C15ull;
+
+    static inline void seedRandom(uint64_t seed) {
+        rngState = seed ^ 0x9E3779B97F4A7C15ull;
+        if (rngState == 0) rngState = 1;
+    }
+
+    static inline uint32_t nextRandom() {
+        // xorshift64*
+        rngState ^= rngState >> 12;
+        rngState ^= rngState << 25;
+        rngState ^= rngState >> 27;
+        return (uint32_t)((rngState * 0x2545F4914F6CDD1Dull) >> 32);
+    }
+
+    static inline int randomBelow(int n) {
+        return (int)(((uint64_t)nextRandom() * (uint64_t)n) >> 32);
+    }
+
+    int totals[kPiles];
+    int numCards[kPiles];
+    bool soft[kPiles];
     int left[11];
     int cardsLeft;
     int curCard;
@@ -59,18 +90,16 @@ struct State {
     int curSuit;
     int curRank;
 
-    State(){
-        for(int i=0;i<4;i++){
+    BasicState(){
+        for(int i=0;i<kPiles;i++){
             totals[i] = 0;
             numCards[i] = 0;
             soft[i] = false;
         }
         for(int i=0;i<11;i++){
-            left[i] = 4;
+            left[i] = Rules::cardsOfValue(i);
         }
-        left[10] = 14;
-        left[0] = 2;
-        cardsLeft = 52;
+        cardsLeft = Rules::kDeckSize;
         curCard = -1;
         streak = 0;
         score = 0;
@@ -95,22 +124,27 @@ struct State {
         curSuit = 0;
         curRank = 0;
     }
+    // Pile value of a physical card: black jacks are wild (0), 10/J/Q/K count 10.
+    static int cardValue(int rank, int suit) {
+        if (rank == 10 && suit >= 2) return 0;
+        if (rank >= 9) return 10;
+        return rank + 1;
+    }
+
     long long simpleHash(){
         long long hashcode = 0;
-        for(int i = 0; i < 4; i++){
+        for(int i = 0; i < kPiles; i++){
             hashcode = hashcode * 22ll + totals[i];
-            hashcode = hashcode * 5ll + min(1,numCards[i]);
+            hashcode = hashcode * (long long)Rules::kClearCards + min(1,numCards[i]);
             hashcode = hashcode * 2ll + soft[i];
         }
 
         if (curCard != -1){
             left[curCard]++;
         }
-        hashcode = hashcode * 3 + left[0];
-        for(int i = 1; i < 10; i++){
-            hashcode = hashcode * 5ll + left[i];
+        for(int i = 0; i < 11; i++){
+            hashcode = hashcode * (long long)(Rules::cardsOfValue(i) + 1) + left[i];
         }
-        hashcode = hashcode * 15ll + left[10];
 
         if (curCard != -1){
             left[curCard]--;
@@ -118,8 +152,8 @@ struct State {
         return hashcode;
     }
 
-    State(State * state){
-        for(int i=0;i<4;i++){
+    BasicState(State * state){
+        for(int i=0;i<kPiles;i++){
             totals[i] = state->totals[i];
             numCards[i] = state->numCards[i];
             soft[i] = state->soft[i];
@@ -152,7 +186,45 @@ struct State {
         curRank = state->curRank;
     }
 
+    // Draws the next card at random (or takes the detected `fixedCard`, as
+    // rank * 4 + suit) and returns the resulting state.
     State * sampleState(int fixedCard = -1) {
+        int drawnCard = -1;
+        if (fixedCard == -1 && !justUndid && nextCard == -1 && cardsLeft > 0) {
+            int card = randomBelow(cardsLeft);
+            int i = 0;
+            while(card >= left[i]){
+                card -= left[i];
+                i++;
+            }
+            drawnCard = i;
+        }
+        return nextState(drawnCard, fixedCard);
+    }
+
+    // Enumerates the outcomes of the next draw with their exact probabilities
+    // and returns how many there are. When the next state is already
+    // determined (undo, known next card, empty deck) there is one outcome
+    // with card -1.
+    int chanceOutcomes(int cards[11], double probs[11]) const {
+        if (justUndid || nextCard != -1 || cardsLeft <= 0) {
+            cards[0] = -1;
+            probs[0] = 1.0;
+            return 1;
+        }
+        int count = 0;
+        for (int v = 0; v < 11; v++) {
+            if (left[v] <= 0) continue;
+            cards[count] = v;
+            probs[count] = (double)left[v] / (double)cardsLeft;
+            count++;
+        }
+        return count;
+    }
+
+    // The state after drawing `drawnCard` (see chanceOutcomes()), or the
+    // detected `fixedCard`, and then applying curMove or the pending undo.
+    State * nextState(int drawnCard, int fixedCard = -1) {
         State * result = new State(this);
         result->undoCounter--;
         if (fixedCard != -1){
@@ -188,7 +260,7 @@ struct State {
             result->undoCounter = 2;
 
             result->streak = result->prevStreak;
-            result->score -= 1;
+            result->score -= Rules::kUndoCost;
             if(result->score < 0){
                 result->score = 0;
             }
@@ -202,23 +274,10 @@ struct State {
             result->left[nextCard]--;
         } else {
             if (result->cardsLeft > 0){
-                int card = rand() % result->cardsLeft;
-                int i = 0;
-                while(card >= result->left[i]){
-                    card -= result->left[i];
-                    i++;
-                }
-
                 if (fixedCard != -1){
-                    if (result->curRank == 10 && result->curSuit >= 2){
-                        result->curCard = 0;
-                    } else if (result->curRank >= 9){
-                        result->curCard = 10;
-                    } else {
-                        result->curCard = result->curRank + 1;
-                    }
+                    result->curCard = cardValue(result->curRank, result->curSuit);
                 } else {
-                    result->curCard = i;
+                    result->curCard = drawnCard;
                 }
                 result->left[result->curCard]--;
             } else if (result->curCard >= 0){
@@ -251,28 +310,18 @@ struct State {
             }
             result->prevCard = curCard;
 
-            if (streak >= 5){
-                result->score += 125;
-            } else if (streak >= 4){
-                result->score += 100;
-            } else if (streak >= 3){
-                result->score += 75;
-            } else if (streak >= 2){
-                result->score += 50;
-            } else if (streak >= 1){
-                result->score += 25;
-            }
-            result->score += 20;
-            if (result->numCards[curMove] >= 4){
-                result->score += 60;
+            result->score += Rules::kStreakBonus[min(streak, Rules::kMaxStreak)];
+            result->score += Rules::kWildBonus;
+            if (result->numCards[curMove] >= Rules::kClearCards - 1){
+                result->score += Rules::kFullPileBonus;
             }
             if (result->totals[curMove] == 11 || result->totals[curMove] == 1){
-                result->score += 40;
+                result->score += Rules::kTwentyOneBonus;
             }
             result->totals[curMove] = 0;
             result->numCards[curMove] = 0;
             result->streak++;
-            result->streak = min(result->streak, 5);
+            result->streak = min(result->streak, Rules::kMaxStreak);
             result->soft[curMove] = false;
         } else if (curCard > 0){
             result->totals[curMove]+=curCard;
@@ -282,7 +331,7 @@ struct State {
             }
             bool cleared = false;
             if (result->totals[curMove] == 21 || (result->totals[curMove] == 11 && result->soft[curMove])
-                || (result->numCards[curMove] >= 5 && result->totals[curMove] <= 21)){
+                || (result->numCards[curMove] >= Rules::kClearCards && result->totals[curMove] <= 21)){
 
                 result->lastPos = curMove;
                 if (result->undoCounter <= 0){
@@ -290,25 +339,15 @@ struct State {
                 }
                 result->prevCard = curCard;
 
-                if (streak >= 5){
-                    result->score += 125;
-                } else if (streak >= 4){
-                    result->score += 100;
-                } else if (streak >= 3){
-                    result->score += 75;
-                } else if (streak >= 2){
-                    result->score += 50;
-                } else if (streak >= 1){
-                    result->score += 25;
-                }
-                if (result->numCards[curMove] >= 5){
-                    result->score += 60;
+                result->score += Rules::kStreakBonus[min(streak, Rules::kMaxStreak)];
+                if (result->numCards[curMove] >= Rules::kClearCards){
+                    result->score += Rules::kFullPileBonus;
                 }
                 if (result->totals[curMove] == 21 || (result->totals[curMove] == 11 && result->soft[curMove])){
-                    result->score += 40;
+                    result->score += Rules::kTwentyOneBonus;
                 }
                 result->streak++;
-                result->streak = min(result->streak, 5);
+                result->streak = min(result->streak, Rules::kMaxStreak);
                 cleared = true;
             } else if (result->totals[curMove] > 21){
                 result->lastPos = curMove;
@@ -338,9 +377,13 @@ struct State {
         }
         if (result->cardsLeft == 0 && result->curCard == -1){
             if (!result->hasBusted){
-                result->score += 10;
-                if (result->numCards[0] == 0 && result->numCards[1] == 0 && result->numCards[2] == 0 && result->numCards[3] == 0){
-                    result->score += 100;
+                result->score += Rules::kNoBustBonus;
+                bool allClear = true;
+                for (int i = 0; i < kPiles; i++) {
+                    if (result->numCards[i] != 0) allClear = false;
+                }
+                if (allClear){
+                    result->score += Rules::kAllClearBonus;
                 }
             }
         }
@@ -349,15 +392,85 @@ struct State {
         return result;
     }
 
-    vector<State *> getAvailableStates() { // Returns the legal moves.
-        vector<State *> result;
+    // One card put on one pile, as nextState() plays it, for the rollout
+    // policy. Piles are looked up by code (see pileCode()).
+    struct PileStep {
+        uint8_t next;   // code of the pile afterwards; 0 once cleared or bust
+        uint8_t points; // clear bonuses, before the streak bonus
+        bool cleared;   // cleared without busting
+        bool bust;
+    };
+
+    // Every PileStep, and which cards clear each pile, tabulated once so that
+    // makeSmartMove() looks placements up instead of re-deriving them.
+    struct PileTables {
+        static constexpr int kCodes = 22 * Rules::kClearCards * 2;
+        static_assert(kCodes <= 256, "PileStep::next is a uint8_t pile code");
+        static_assert(Rules::kWildBonus + Rules::kFullPileBonus + Rules::kTwentyOneBonus <= UINT8_MAX,
+                      "PileStep::points is a uint8_t");
+
+        PileStep steps[kCodes][11];
+        uint16_t clearMask[kCodes]; // bit v set: a card of value v (1-10) clears the pile
+
+        PileTables() {
+            for (int code = 0; code < kCodes; code++) {
+                const int total = code / (2 * Rules::kClearCards);
+                const int num = (code / 2) % Rules::kClearCards;
+                const bool isSoft = (code & 1) != 0;
+                clearMask[code] = 0;
+                for (int v = 0; v <= 10; v++) {
+                    PileStep &step = steps[code][v];
+                    step = PileStep{0, 0, false, false};
+                    if (v == 0) {
+                        step.cleared = true;
+                        step.points = Rules::kWildBonus;
+                        if (num >= Rules::kClearCards - 1) step.points += Rules::kFullPileBonus;
+                        if (total == 11 || total == 1) step.points += Rules::kTwentyOneBonus;
+                        continue;
+                    }
+                    const int newTotal = total + v;
+                    const int newNum = num + 1;
+                    bool newSoft = isSoft;
+                    if (newTotal <= 11 && v == 1) newSoft = true;
+                    if (newTotal > 11) newSoft = false;
+                    if (newTotal > 21) {
+                        step.bust = true;
+                    } else if (newTotal == 21 || (newTotal == 11 && newSoft) || newNum >= Rules::kClearCards) {
+                        step.cleared = true;
+                        if (newNum >= Rules::kClearCards) step.points += Rules::kFullPileBonus;
+                        if (newTotal == 21 || (newTotal == 11 && newSoft)) step.points += Rules::kTwentyOneBonus;
+                        clearMask[code] |= (uint16_t)(1u << v);
+                    } else {
+                        step.next = (uint8_t)pileCode(newTotal, newNum, newSoft);
+                    }
+                }
+            }
+        }
+    };
+
+    static int pileCode(int total, int numCards, bool isSoft) {
+        return (total * Rules::kClearCards + numCards) * 2 + (isSoft ? 1 : 0);
+    }
+
+    static const PileTables &pileTables() {
+        static const PileTables tables;
+        return tables;
+    }
+
+    // Moves are encoded as the pile index (0 to kPiles-1) or kMoveUndo.
+    static const int kMoveUndo = kPiles;
+    static const int kMaxMoves = kPiles + 1;
+
+    // Writes the legal moves into `moves` and returns how many there are.
+    int generateMoves(uint8_t moves[kMaxMoves]) const {
+        int count = 0;
 
         if (isTerminal()) {
-            return result;
+            return count;
         }
 
         int numSpaces = 0;
-        for(int i = 0; i < 4; i++){
+        for(int i = 0; i < kPiles; i++){
             if (totals[i] == 0) numSpaces++;
         }
 
@@ -382,7 +495,7 @@ struct State {
         }
         int numUndoSlots = 0;
         if (curCard >= 0){
-            for(int i = 0; i < 4; i++){
+            for(int i = 0; i < kPiles; i++){
                 if (nextCard != -1 && i == lastPos && undoCounter == 2) continue;
                 bool isDuplicate = false;
                 for(int j = 0; j < i; j++){
@@ -410,17 +523,34 @@ struct State {
                     continue;
                 }
 
-                State * newState = new State(this);
-                newState->curMove = i;
-                result.push_back(newState);
+                moves[count++] = (uint8_t)i;
             }
         }
 
         if (canUndo && numUndoSlots > 0){ // undo
-            State * newState = new State(this);
+            moves[count++] = (uint8_t)kMoveUndo;
+        }
+        return count;
+    }
+
+    State * applyMove(int move) { // Returns a copy of this state with `move` chosen.
+        State * newState = new State(this);
+        if (move == kMoveUndo) {
             newState->justUndid = true;
             newState->canUndo = false;
-            result.push_back(newState);
+        } else {
+            newState->curMove = move;
+        }
+        return newState;
+    }
+
+    vector<State *> getAvailableStates() { // Returns the legal moves.
+        uint8_t moves[kMaxMoves];
+        const int count = generateMoves(moves);
+        vector<State *> result;
+        result.reserve(count);
+        for (int i = 0; i < count; i++) {
+            result.push_back(applyMove(moves[i]));
         }
         return result;
     }
@@ -431,17 +561,17 @@ struct State {
 
     void print() const { // Prints the current state.
         cerr << "totals: ";
-        for(int i=0;i<4;i++){
+        for(int i=0;i<kPiles;i++){
             cerr << totals[i] << " ";
         }
         cerr << endl;
         cerr << "numCards: ";
-        for(int i=0;i<4;i++){
+        for(int i=0;i<kPiles;i++){
             cerr << numCards[i] << " ";
         }
         cerr << endl;
         cerr << "soft: ";
-        for(int i=0;i<4;i++){
+        for(int i=0;i<kPiles;i++){
             cerr << soft[i] << " ";
         }
         cerr << endl;
@@ -485,7 +615,7 @@ struct State {
                     default: overlay_set_text_color(1.0, 1.0, 1.0, 1.0); break;
                 }
             }
-            double posX = windowX + windowW * curMove / 5 + windowW / 8;
+            double posX = windowX + windowW * curMove / (kPiles + 1) + windowW / 8;
             double posY = windowY + windowH / 2;
             overlay_set_text_position(posX, posY);
             overlay_set_text_utf8(to_string(curCard).c_str());
@@ -494,28 +624,28 @@ struct State {
 
     long long hash_code() const { // Returns a hash code for the current state.
         long long result = 0;
-        for(int i=0;i<4;i++){
+        for(int i=0;i<kPiles;i++){
             result = result * 23 + totals[i];
         }
-        for(int i=0;i<4;i++){
-            result = result * 5 + numCards[i];
+        for(int i=0;i<kPiles;i++){
+            result = result * Rules::kClearCards + numCards[i];
         }
         for(int i=0;i<11;i++){
-            result = result * 5 + left[i];
+            result = result * (Rules::cardsOfValue(i) + 1) + left[i];
         }
-        result = result * 53 + cardsLeft;
+        result = result * (Rules::kDeckSize + 1) + cardsLeft;
         result = result * 13 + curCard;
-        result = result * 7 + streak;
+        result = result * (Rules::kMaxStreak + 2) + streak;
         result = result * 293 + score;
         result = result * 13 + (nextCard+1);
         result = result * 2 + hasBusted;
-        result = result * 7 + (curMove+1);
+        result = result * (kMaxMoves + 1) + (curMove+1);
 
         return result;
     }
 
     bool makeRandomMove(){
-        int move = rand() % 4;
+        int move = randomBelow(kPiles);
         curMove = move;
         return true;
     }
@@ -530,35 +660,33 @@ struct State {
             return true;
         }
 
+        const SmartMoveWeights &w = *SmartMoveWeights::active();
+
         auto streakBonus = [](int s) -> int {
-            if (s >= 5) return 125;
-            if (s == 4) return 100;
-            if (s == 3) return 75;
-            if (s == 2) return 50;
-            if (s == 1) return 25;
-            return 0;
+            return Rules::kStreakBonus[max(0, min(s, Rules::kMaxStreak))];
         };
 
-        auto wouldClearWith = [](int pileTotal, int pileNumCards, bool pileSoft, int cardVal) -> bool {
-            if (cardVal <= 0) return false;
-            const int newTotal = pileTotal + cardVal;
-            const int newNum = pileNumCards + 1;
-            bool newSoft = pileSoft;
-            if (newTotal <= 11 && cardVal == 1) {
-                newSoft = true;
+        const PileTables &pileTable = pileTables();
+        // Table lookups use the profile of the deck a choice is evaluated
+        // against, worked out again only when that deck changes.
+        const ClearTable &clearTable = ClearTable::active();
+        int profiledLeft[11];
+        int profiledCardsLeft = -1;
+        int deckProfile = 0;
+        auto profileOf = [&](int cardsLeftIn, const int leftCounts[11]) -> int {
+            bool same = cardsLeftIn == profiledCardsLeft;
+            for (int v = 0; v < 11 && same; v++) same = leftCounts[v] == profiledLeft[v];
+            if (!same) {
+                for (int v = 0; v < 11; v++) profiledLeft[v] = leftCounts[v];
+                profiledCardsLeft = cardsLeftIn;
+                deckProfile = ClearTable::profile(leftCounts, cardsLeftIn);
             }
-            if (newTotal > 11) {
-                newSoft = false;
-            }
-            if (newTotal == 21) return true;
-            if (newTotal == 11 && newSoft) return true;
-            if (newNum >= 5 && newTotal <= 21) return true;
-            return false;
+            return deckProfile;
         };
 
         const int currentCard = curCard;
         int numSpacesNow = 0;
-        for (int i = 0; i < 4; i++) {
+        for (int i = 0; i < kPiles; i++) {
             if (totals[i] == 0) numSpacesNow++;
         }
 
@@ -573,13 +701,13 @@ struct State {
 
         // Mirror the legality rules in getAvailableStates().
         auto isPileChoiceLegal = [&](int pileIndex, int cardVal) -> bool {
-            if (pileIndex < 0 || pileIndex >= 4) return false;
+            if (pileIndex < 0 || pileIndex >= kPiles) return false;
             if (nextCard != -1 && pileIndex == lastPos && undoCounter == 2) return false;
             if (cardVal > 0 && totals[pileIndex] + cardVal > 21 && numSpacesNow > 0) return false;
             return true;
         };
 
-        auto collectUndoAlternatives = [&](int outMoves[4]) -> int {
+        auto collectUndoAlternatives = [&](int outMoves[kPiles]) -> int {
             // Mirrors getAvailableStates(): undo is legal iff there exists at least one
             // legal pile choice for playing prevCard AFTER undo (excluding lastPos).
             if (!canUndo || lastPos < 0 || prevCard < 0) return 0;
@@ -603,7 +731,7 @@ struct State {
             }
 
             int count = 0;
-            for (int i = 0; i < 4; i++) {
+            for (int i = 0; i < kPiles; i++) {
                 if (nextCard != -1 && i == lastPos && undoCounter == 2) continue;
                 if (isDuplicatePileState(i)) continue;
                 if (i == lastPos) continue;
@@ -620,14 +748,14 @@ struct State {
             return count;
         };
 
-        int undoMoves[4];
+        int undoMoves[kPiles];
         const int undoOptions = collectUndoAlternatives(undoMoves);
 
         auto applyCardToPiles = [&](int cardVal,
                                     int chosenPile,
-                                    int t[4],
-                                    int n[4],
-                                    bool s[4],
+                                    int t[kPiles],
+                                    int n[kPiles],
+                                    bool s[kPiles],
                                     int streakIn,
                                     int &immediatePoints,
                                     int &streakOut,
@@ -635,71 +763,25 @@ struct State {
             immediatePoints = 0;
             streakOut = 0;
             causedBust = false;
-
-            if (cardVal == 0) {
-                immediatePoints += streakBonus(streakIn);
-                immediatePoints += 20;
-                if (n[chosenPile] >= 4) immediatePoints += 60;
-                if (t[chosenPile] == 11 || t[chosenPile] == 1) immediatePoints += 40;
-                streakOut = min(streakIn + 1, 5);
-
-                t[chosenPile] = 0;
-                n[chosenPile] = 0;
-                s[chosenPile] = false;
+            if (cardVal < 0) {
                 return;
             }
 
-            if (cardVal <= 0) {
-                streakOut = 0;
-                return;
-            }
-
-            const int newTotal = t[chosenPile] + cardVal;
-            const int newNum = n[chosenPile] + 1;
-            bool newSoft = s[chosenPile];
-            if (newTotal <= 11 && cardVal == 1) {
-                newSoft = true;
-            }
-            if (newTotal > 11) {
-                newSoft = false;
-            }
-
-            bool cleared = false;
-            if (newTotal == 21) {
-                cleared = true;
-            } else if (newTotal == 11 && newSoft) {
-                cleared = true;
-            } else if (newNum >= 5 && newTotal <= 21) {
-                cleared = true;
-            } else if (newTotal > 21) {
-                causedBust = true;
-                cleared = true;
-            }
-
-            if (cleared && !causedBust) {
-                immediatePoints += streakBonus(streakIn);
-                if (newNum >= 5) immediatePoints += 60;
-                if (newTotal == 21 || (newTotal == 11 && newSoft)) immediatePoints += 40;
-                streakOut = min(streakIn + 1, 5);
-            } else {
-                streakOut = 0;
-            }
-
-            if (cleared) {
-                t[chosenPile] = 0;
-                n[chosenPile] = 0;
-                s[chosenPile] = false;
-            } else {
-                t[chosenPile] = newTotal;
-                n[chosenPile] = newNum;
-                s[chosenPile] = newSoft;
+            const PileStep &step = pileTable.steps[pileCode(t[chosenPile], n[chosenPile], s[chosenPile])][cardVal];
+            causedBust = step.bust;
+            if (step.cleared) {
+                immediatePoints = streakBonus(streakIn) + step.points;
+                streakOut = min(streakIn + 1, Rules::kMaxStreak);
             }
+            t[chosenPile] = step.next / (2 * Rules::kClearCards);
+            n[chosenPile] = (step.next / 2) % Rules::kClearCards;
+            s[chosenPile] = (step.next & 1) != 0;
         };
 
-        auto isLegalGivenPiles = [&](const int t[4], int cardVal, int pileIndex) -> bool {
-            if (pileIndex < 0 || pileIndex >= 4) return false;
+        auto isLegalGivenPiles = [&](const int t[kPiles], int cardVal, int pileIndex) -> bool {
+            if (pileIndex < 0 || pileIndex >= kPiles) return false;
             int spaces = 0;
-            for (int k = 0; k < 4; k++) {
+            for (int k = 0; k < kPiles; k++) {
                 if (t[k] == 0) spaces++;
             }
             if (cardVal > 0 && t[pileIndex] + cardVal > 21 && spaces > 0) return false;
@@ -708,17 +790,17 @@ struct State {
 
         auto evalChoiceFrom = [&](int cardVal,
                                   int chosenPile,
-                                  const int baseTotals[4],
-                                  const int baseNumCards[4],
-                                  const bool baseSoft[4],
+                                  const int baseTotals[kPiles],
+                                  const int baseNumCards[kPiles],
+                                  const bool baseSoft[kPiles],
                                   int streakIn,
                                   bool hasBustedIn,
                                   int cardsLeftIn,
                                   const int leftCounts[11]) -> double {
-            int t[4];
-            int n[4];
-            bool s[4];
-            for (int k = 0; k < 4; k++) {
+            int t[kPiles];
+            int n[kPiles];
+            bool s[kPiles];
+            for (int k = 0; k < kPiles; k++) {
                 t[k] = baseTotals[k];
                 n[k] = baseNumCards[k];
                 s[k] = baseSoft[k];
@@ -730,48 +812,60 @@ struct State {
             applyCardToPiles(cardVal, chosenPile, t, n, s, streakIn, immediatePoints, nextStreak, causedBust);
 
             int numSpacesAfter = 0;
-            for (int k = 0; k < 4; k++) {
+            for (int k = 0; k < kPiles; k++) {
                 if (t[k] == 0) numSpacesAfter++;
             }
 
             // One-step lookahead: how many remaining next-card values can immediately clear *some* pile?
-            bool goodVal[11] = {false};
+            unsigned goodVals = 0;
+            for (int k = 0; k < kPiles; k++) {
+                goodVals |= pileTable.clearMask[pileCode(t[k], n[k], s[k])];
+            }
             int distinctClearVals = 0;
             int clearOuts = 0;
             for (int v = 1; v <= 10; v++) {
-                for (int k = 0; k < 4; k++) {
-                    if (wouldClearWith(t[k], n[k], s[k], v)) {
-                        goodVal[v] = true;
-                        break;
-                    }
-                }
-                if (goodVal[v]) {
+                if (goodVals & (1u << v)) {
                     distinctClearVals++;
                     clearOuts += leftCounts[v];
                 }
             }
 
+            // Longer lookahead from the clearability table, if loaded: each
+            // pile's chance to clear or bust within the next kPolicyCards cards.
+            double clearChance = 0.0;
+            double bustRisk = 0.0;
+            if (clearTable.loaded) {
+                const int profile = profileOf(cardsLeftIn, leftCounts);
+                for (int k = 0; k < kPiles; k++) {
+                    const ClearTable::Entry &entry = clearTable.at(profile, t[k], n[k], s[k]);
+                    clearChance += entry.clear[ClearTable::kPolicyCards - 1];
+                    bustRisk += entry.bust[ClearTable::kPolicyCards - 1];
+                }
+            }
+
             double dangerPenalty = 0.0;
-            for (int k = 0; k < 4; k++) {
-                if (t[k] == 20) dangerPenalty += 18.0;
-                else if (t[k] == 19) dangerPenalty += 10.0;
-                else if (t[k] == 18) dangerPenalty += 4.0;
+            for (int k = 0; k < kPiles; k++) {
+                if (t[k] == 20) dangerPenalty += w.danger20Penalty;
+                else if (t[k] == 19) dangerPenalty += w.danger19Penalty;
+                else if (t[k] == 18) dangerPenalty += w.danger18Penalty;
             }
 
             double bustPenalty = 0.0;
             if (causedBust) {
-                bustPenalty = hasBustedIn ? 12.0 : 70.0;
-                if (cardsLeftIn <= 12) bustPenalty += 20.0;
+                bustPenalty = hasBustedIn ? w.repeatBustPenalty : w.firstBustPenalty;
+                if (cardsLeftIn <= 12) bustPenalty += w.lateBustPenalty;
             }
 
             double eval = 0.0;
             eval += (double)immediatePoints;
-            eval += 2.6 * (double)clearOuts;
-            eval += 6.0 * (double)distinctClearVals;
-            eval += (numSpacesAfter > 0 ? 8.0 : -8.0);
+            eval += w.clearOutWeight * (double)clearOuts;
+            eval += w.distinctClearWeight * (double)distinctClearVals;
+            eval += w.clearChanceWeight * clearChance;
+            eval -= w.bustRiskWeight * bustRisk;
+            eval += (numSpacesAfter > 0 ? w.emptyPileBonus : -w.emptyPileBonus);
             eval -= dangerPenalty;
             eval -= bustPenalty;
-            eval += 10.0 * (double)nextStreak;
+            eval += w.nextStreakWeight * (double)nextStreak;
             return eval;
         };
 
@@ -783,10 +877,10 @@ struct State {
             if (undoOptions <= 0) return -1e300;
 
             // Build the deterministic post-undo state (as sampleState() would do).
-            int tU[4];
-            int nU[4];
-            bool sU[4];
-            for (int k = 0; k < 4; k++) {
+            int tU[kPiles];
+            int nU[kPiles];
+            bool sU[kPiles];
+            for (int k = 0; k < kPiles; k++) {
                 tU[k] = totals[k];
                 nU[k] = numCards[k];
                 sU[k] = soft[k];
@@ -830,25 +924,25 @@ struct State {
             // Undo is especially valuable if it removes the first-ever bust.
             double baseBonus = 0.0;
             if (hasBusted && !wasBusted) {
-                baseBonus += 85.0;
+                baseBonus += w.undoFirstBustBonus;
             }
             if (prevStreak > streak) {
-                baseBonus += 10.0 * (double)(prevStreak - streak);
+                baseBonus += w.undoStreakRestore * (double)(prevStreak - streak);
             }
 
             // Value undo by best 2-card sequence using a conservative model:
             // - immediate scoring from placing prevCard
             // - then immediate scoring from placing the known next card
             // - strong bust penalties (especially for the first bust)
-            const double step2Weight = 0.85;
+            const double step2Weight = w.undoStep2Weight;
             double bestSeq = -1e300;
             for (int idx = 0; idx < undoOptions; idx++) {
                 const int firstPile = undoMoves[idx];
 
-                int t1[4];
-                int n1[4];
-                bool s1[4];
-                for (int k = 0; k < 4; k++) {
+                int t1[kPiles];
+                int n1[kPiles];
+                bool s1[kPiles];
+                for (int k = 0; k < kPiles; k++) {
                     t1[k] = tU[k];
                     n1[k] = nU[k];
                     s1[k] = sU[k];
@@ -862,8 +956,8 @@ struct State {
 
                 double bustPenalty1 = 0.0;
                 if (bust1) {
-                    bustPenalty1 = hasBustedU ? 12.0 : 70.0;
-                    if (cardsLeftU <= 12) bustPenalty1 += 20.0;
+                    bustPenalty1 = hasBustedU ? w.repeatBustPenalty : w.firstBustPenalty;
+                    if (cardsLeftU <= 12) bustPenalty1 += w.lateBustPenalty;
                 }
 
                 double bestImmediate2 = 0.0;
@@ -874,13 +968,13 @@ struct State {
                     bestImmediate2 = -1e300;
                     bestBustPenalty2 = 0.0;
                     streak2Best = 0;
-                    for (int k = 0; k < 4; k++) {
+                    for (int k = 0; k < kPiles; k++) {
                         if (!isLegalGivenPiles(t1, knownNext, k)) continue;
 
-                        int t2[4];
-                        int n2[4];
-                        bool s2[4];
-                        for (int j = 0; j < 4; j++) {
+                        int t2[kPiles];
+                        int n2[kPiles];
+                        bool s2[kPiles];
+                        for (int j = 0; j < kPiles; j++) {
                             t2[j] = t1[j];
                             n2[j] = n1[j];
                             s2[j] = s1[j];
@@ -893,11 +987,11 @@ struct State {
 
                         double bustPenalty2 = 0.0;
                         if (bust2) {
-                            bustPenalty2 = hasBusted1 ? 12.0 : 70.0;
-                            if ((cardsLeftU - 1) <= 12) bustPenalty2 += 20.0;
+                            bustPenalty2 = hasBusted1 ? w.repeatBustPenalty : w.firstBustPenalty;
+                            if ((cardsLeftU - 1) <= 12) bustPenalty2 += w.lateBustPenalty;
                         }
 
-                        const double v2 = (double)immediate2 - bustPenalty2 + 6.0 * (double)streak2;
+                        const double v2 = (double)immediate2 - bustPenalty2 + w.undoSeqStreakWeight * (double)streak2;
                         if (!found2 || v2 > bestImmediate2) {
                             found2 = true;
                             bestImmediate2 = v2;
@@ -914,21 +1008,21 @@ struct State {
 
                 // Small preference for having at least one empty pile after step 1.
                 int spacesAfter1 = 0;
-                for (int k = 0; k < 4; k++) {
+                for (int k = 0; k < kPiles; k++) {
                     if (t1[k] == 0) spacesAfter1++;
                 }
 
                 const double seq = baseBonus + undoImmediateDelta
-                    + (double)immediate1 - bustPenalty1 + 6.0 * (double)streak1
+                    + (double)immediate1 - bustPenalty1 + w.undoSeqStreakWeight * (double)streak1
                     + step2Weight * (bestImmediate2)
-                    + (spacesAfter1 > 0 ? 3.0 : -3.0);
+                    + (spacesAfter1 > 0 ? w.undoEmptyPileBonus : -w.undoEmptyPileBonus);
 
                 if (seq > bestSeq) bestSeq = seq;
             }
 
             // Avoid pathological undoing very late unless it's fixing a bust.
             if (cardsLeft <= 6 && !(hasBusted && !wasBusted)) {
-                bestSeq -= 25.0;
+                bestSeq -= w.lateUndoPenalty;
             }
 
             return bestSeq;
@@ -938,7 +1032,7 @@ struct State {
         double bestEval = -1e300;
 
         // Evaluate pile choices.
-        for (int i = 0; i < 4; i++) {
+        for (int i = 0; i < kPiles; i++) {
             if (!isPileChoiceLegal(i, currentCard)) continue;
             const double ev = evalPileChoice(i);
             if (ev > bestEval) {
@@ -963,44 +1057,66 @@ struct State {
         return true;
     }
 
-    void getRGB(uint8 * pixels, int width, int height, int bpp, int x, int y, uint8 &r, uint8 &g, uint8 &b){
-
+    // Maps reference (714x1056) coordinate (x,y) into source-image pixels.
+    static void mapToSource(int sourceWidth, int sourceHeight, int x, int y, int &px, int &py) {
         int refWidth = 714;
         int refHeight = 1056;
         double xpct = (double)x / (double)refWidth;
         double ypct = (double)y / (double)refHeight;
-        x = (int)llround(xpct * (double)width);
-        y = (int)llround(ypct * (double)height);
+        x = (int)llround(xpct * (double)sourceWidth);
+        y = (int)llround(ypct * (double)sourceHeight);
 
         // Map screen-space coords (x,y) into the provided pixel buffer.
-        const int px = (int)llround((x - captureOffsetX) * captureScaleX);
-        const int py = (int)llround((y - captureOffsetY) * captureScaleY);
+        px = (int)llround((x - captureOffsetX) * captureScaleX);
+        py = (int)llround((y - captureOffsetY) * captureScaleY);
+    }
+
+    // The card region of interest in source-image pixels, as [x0,x1) x [y0,y1).
+    static void cardRegion(int sourceWidth, int sourceHeight, int &x0, int &y0, int &x1, int &y1) {
+        mapToSource(sourceWidth, sourceHeight, kCardRoiLeft, kCardRoiTop, x0, y0);
+        mapToSource(sourceWidth, sourceHeight, kCardRoiRight, kCardRoiBottom, x1, y1);
+    }
 
-        if (px < 0 || py < 0 || px >= width || py >= height || bpp <= 0) {
+    static const uint8_t * probePixel(const Frame &frame, int x, int y) {
+        int px, py;
+        mapToSource(frame.sourceWidth, frame.sourceHeight, x, y, px, py);
+        return frame.pixel(px, py);
+    }
+
+    void getRGB(const Frame &frame, int x, int y, uint8_t &r, uint8_t &g, uint8_t &b){
+        const uint8_t * p = probePixel(frame, x, y);
+        if (p == nullptr) {
             r = g = b = 0;
             return;
         }
-
-        uint8 * p = pixels + (py * width + px) * bpp;
-        r = (uint8)(p[2]);
-        g = (uint8)(p[1]);
-        b = (uint8)(p[0]);
+        r = p[2];
+        g = p[1];
+        b = p[0];
     }
 
+    State * fromPixels(uint8_t *pixels, int width, int height, int bpp, int prevCard){
+        return fromFrame(Frame::view(pixels, width, height, bpp), prevCard);
+    }
 
-    State * fromPixels(uint8 *pixels, int width, int height, int bpp, int prevCard){
+    // Detects the card in `frame` and returns the state after drawing it, or
+    // NULL. If `reading` is given it receives the detected card and its
+    // confidence (see CardReading).
+    State * fromFrame(const Frame &frame, int prevCard, CardReading * reading = nullptr){
+        if (reading != nullptr) {
+            *reading = CardReading();
+        }
 
         int cardExistx1 = 401;
         int cardExisty = 793;
         int cardExistx2 = 482;
 
-        uint8 r,g,b;
+        uint8_t r,g,b;
 
-        getRGB(pixels, width, height, bpp, cardExistx1, cardExisty, r, g, b);
+        getRGB(frame, cardExistx1, cardExisty, r, g, b);
         if (r < 220 || g < 220 || b < 220){
             return NULL;
         }
-        getRGB(pixels, width, height, bpp, cardExistx2, cardExisty, r, g, b);
+        getRGB(frame, cardExistx2, cardExisty, r, g, b);
         if (r < 220 || g < 220 || b < 220){
             return NULL;
         }
@@ -1008,157 +1124,39 @@ struct State {
         // detect dark around the card 
         int cardNotExistx = 385;
 
-        getRGB(pixels, width, height, bpp, cardNotExistx, cardExisty, r, g, b);
+        getRGB(frame, cardNotExistx, cardExisty, r, g, b);
         if (r > 200 && g > 200 && b > 200){
             return NULL;
         }
 
-        int suit = -1;
-
-        int suitx1 = 460;
-        int suity1 = 744;
-        getRGB(pixels, width, height, bpp, suitx1, suity1, r, g, b);
-
-        bool leftRed = r > 180 && g < 60 && b < 50;
-
-        int suitx2 = 477;
-        int suity2 = 744;
-        getRGB(pixels, width, height, bpp, suitx2, suity2, r, g, b);
-
-        bool rightRed = r > 180 && g < 60 && b < 50;
-
-        if (rightRed){
-            suit = 0; // heart
-        }
-
-        int suitx3 = 468;
-        int suity3 = 742;
-        getRGB(pixels, width, height, bpp, suitx3, suity3, r, g, b);
-
-        if (r > 180 && g < 60 && b < 60){
-            if (suit == -1){
-                suit = 1; // diamond
-            }
-        }
-        bool leftBlack = false;
-        bool rightBlack = false;
-        if (r < 95 && g < 95 && b < 95){
-            int suitx4 = 463;
-            int suity4 = 742;
-            getRGB(pixels, width, height, bpp, suitx4, suity4, r, g, b);
-
-            bool leftBlack = r < 105 && g < 105 && b < 105;
-
-            int suitx5 = 472;
-            int suity5 = 742;
-            getRGB(pixels, width, height, bpp, suitx5, suity5, r, g, b);
-
-            bool rightBlack = r < 105 && g < 105 && b < 105;
-
-            suit = leftBlack && rightBlack ? 2 : 3; // club or spade
-            if (leftBlack != rightBlack) suit = -1;
-        }
-
-        int rank = -1;
-
-        vector<vector<pair<int, int>>> filled = {
-            {{440,786},{440,821},{419,834},{465,835}}, // A
-            {{441,785},{425,796},{454,796},{448,813},{443,833},{459,833}}, // 2
-            {{442,785},{441,809},{441,834},{425,833}}, // 3
-            {{450,786},{433,800},{420,821},{464,820},{452,835},{439,822}}, // 4
-            {{426,784},{457,784},{442,784},{428,797},{428,809},{442,835}}, // 5
-            {{442,785},{441,809},{441,834}, {431,809},{424,820}}, // 6
-            {{422,786},{441,786},{461,786},{451,800},{443,814},{439,835}}, // 7
-            {{442,785},{441,809},{441,834}, {431,809},{424,820},{460,799},{424,819}}, // 8
-            {{442,785},{441,809},{441,834}, {431,809},{459,796}}, // 9
-            {{410,794},{424,837}}, // 10
-            {{457,785},{441,834},{426,820}}, // J
-            {{464,845},{442,786}}, // Q
-            {{424,784},{457,785},{437,810},{424,834},{460,834}}, // K
-            {{457,785},{441,834},{426,820}} // J
-        };
-        vector<vector<pair<int, int>>> empty = {
-            {{440,810},{440,834}}, // A
-            {{425,807},{459,820},{440,799}}, // 2
-            {{441,796},{441,822},{431,809}}, // 3
-            {{440,810}}, // 4
-            {{459,796},{443,796},{424,819}}, // 5
-            {{441,796},{441,822},{460,799}}, // 6
-            {{427,798},{426,824}}, // 7
-            {{441,796},{441,822}}, // 8
-            {{441,796},{441,822},{424,820}}, // 9
-            {{458,809}}, // 10
-            {{424,806},{425,786},{440,818}}, // J
-            {{441,809}}, // Q
-            {{410,794},{439,834},{439,784}}, // K
-            {{424,806},{425,786},{440,818}} // J
-        };
-        vector<int> ranks = {0,1,2,3,4,5,6,7,8,9,10,11,12,10};
-        vector<bool> good = vector<bool>(filled.size(), true);
-        vector<int> bad;
-        for(int i = 0; i < filled.size(); i++){
-            for(int j = 0; j < filled[i].size(); j++){
-                getRGB(pixels, width, height, bpp, filled[i][j].first, filled[i][j].second, r, g, b);
-                if (r < 95 && g < 95 && b < 95){ // black
-
-                } else if (r > 70 && r < 100 && g > 70 && g < 100 && b > 70 && b < 100){ // black
-
-                } else if (r > 85 && r < 110 && g > 85 && g < 110 && b > 85 && b < 110){ // black
-
-                } else if (r > 70 && r < 110 && g < 40 && b > 90 && b < 120){ // purple
-                    
-                } else if (r > 140 && g < 60 && b < 80){ // red
-
-                } else if (r > 130 && r < 180 && g < 50 && b > 10 && b < 80){ // red
-                    
-                } else if (r > 170 && r < 220 && g < 45 && b > 70 && b < 120){
-                    
-                } else if (r > 170 && r < 200 && g < 25 && b > 20 && b < 70){
-                    
-                } else {
-                    good[i] = false;
-                    if (i == 8) {
-                        //bad.push_back(j);
-                        //cout << (int)r << " " << (int)g << " " << (int)b << endl;
-                    }
-                    break;
-                }
-            }
+        // Suit and rank each come from a few probes chosen by the trained
+        // trees in recognition_tree.h (--train-recognition).
+        double suitClosest = 0.0;
+        const int suit = walkProbeTree(kSuitTree, 4, [&](int x, int y) -> uint8_t {
+            const uint8_t *p = probePixel(frame, x, y);
+            return p != nullptr ? suitPixelClass(p[2], p[1], p[0]) : (uint8_t)SUIT_OTHER;
+        }, suitClosest);
+        if (suit < 0) {
+            return NULL;
         }
-        for(int i = 0; i < empty.size(); i++){
-            if (!good[i]) continue;
-            for(int j = 0; j < empty[i].size(); j++){
-                getRGB(pixels, width, height, bpp, empty[i][j].first, empty[i][j].second, r, g, b);
-                if (r > 180 && g > 180 && b > 180){ // white
 
-                } else {
-                    good[i] = false;
-                    if (i == 1) bad.push_back(j);
-                    break;
-                }
-            }
+        const ColorTable &colors = colorTable();
+        double rankClosest = 0.0;
+        const int rank = walkProbeTree(kRankTree, 13, [&](int x, int y) -> uint8_t {
+            const uint8_t *p = probePixel(frame, x, y);
+            return p != nullptr ? colors.classify(p[2], p[1], p[0]) : (uint8_t)PIXEL_OTHER;
+        }, rankClosest);
+        if (rank < 0 || rank * 4 + suit == prevCard) {
+            return NULL;
         }
 
-        bool hasGood = false;
-        for(int i = 0; i < good.size(); i++){
-            if (good[i]) {
-                hasGood = true;
-            }
-            if (good[i] && suit >= 0 && ranks[i] * 4 + suit != prevCard){
-                int card = ranks[i];
-                card = card * 4 + suit;
-                return sampleState(card);
-            }
-        }
-        if (suit < 0){
-            //cerr << "bad suit " << leftRed << " " << rightRed << " " << leftBlack << " " << rightBlack << endl;
+        if (reading != nullptr) {
+            reading->rank = rank;
+            reading->suit = suit;
+            reading->confidence = 1.0 - max(rankClosest, suitClosest);
         }
-        if (!hasGood){
-            // cerr << "no good" << endl;
-            // for(int i = 0; i < bad.size(); i++){
-            //     cerr << bad[i] << " ";
-            // }
-        } 
-        return NULL;
+        return sampleState(rank * 4 + suit);
     }
-};
\ No newline at end of file
+};
+
+using State = BasicState<GAME_RULES>;
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Latency of every detected card, from the first capture that showed it to
+// the overlay redraw that showed the move. Timestamps are monotonicUs()
+// values (see pipeline.h); 0 means the stage did not run for this card.
+struct CardTrace {
+    int card = -1;
+    uint64_t frame = 0;            // sequence number of the accepting frame
+    bool confirmed = false;        // needed a second, identical capture
+    bool fromBook = false;
+    int64_t firstCaptureUs = 0;    // capture start of the first frame showing the card
+    int64_t captureStartUs = 0;    // accepting frame
+    int64_t captureEndUs = 0;
+    int64_t convertEndUs = 0;      // card region converted to BGRA
+    int64_t recogniseStartUs = 0;  // fromFrame()
+    int64_t recogniseEndUs = 0;
+    int64_t deliveredUs = 0;       // search stage picked the card up
+    int64_t searchStartUs = 0;     // MCTS() or the opening book
+    int64_t searchEndUs = 0;
+    int64_t showStartUs = 0;       // showBestMove()
+    int64_t redrawEndUs = 0;       // overlay_redraw() returned
+
+    // Last stage that ran: the redraw live, the search or delivery offline.
+    int64_t endUs() const { return redrawEndUs != 0 ? redrawEndUs : searchEndUs != 0 ? searchEndUs : deliveredUs; }
+    int64_t endToEndUs() const { return endUs() - firstCaptureUs; }
+};
+
+// Keeps a rolling window of traces for percentile summaries and optionally
+// streams every trace to a Chrome trace-event file (chrome://tracing,
+// Perfetto). The file is a JSON array whose closing bracket is left off,
+// which the format allows, so it stays loadable if the process is killed.
+class LatencyTracer {
+public:
+    static constexpr size_t kWindow = 256;
+
+    ~LatencyTracer() {
+        if (file != NULL) fclose(file);
+    }
+
+    bool open(const std::string &path) {
+        file = fopen(path.c_str(), "w");
+        if (file == NULL) return false;
+        fprintf(file, "[\n");
+        const char *threads[] = {"", "capture", "recognition", "search", "overlay"};
+        for (int tid = 1; tid <= 4; tid++) {
+            fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                    tid, threads[tid]);
+        }
+        fflush(file);
+        return true;
+    }
+
+    void add(const CardTrace &trace) {
+        recent.push_back(trace);
+        if (recent.size() > kWindow) recent.pop_front();
+        count++;
+        if (file == NULL) return;
+        span(trace, "capture", 1, trace.captureStartUs, trace.captureEndUs);
+        span(trace, "convert", 1, trace.captureEndUs, trace.convertEndUs);
+        if (trace.confirmed) span(trace, "await confirmation", 2, trace.firstCaptureUs, trace.captureStartUs);
+        span(trace, "fromFrame", 2, trace.recogniseStartUs, trace.recogniseEndUs);
+        span(trace, "queued", 3, trace.recogniseEndUs, trace.deliveredUs);
+        span(trace, trace.fromBook ? "book" : "MCTS", 3, trace.searchStartUs, trace.searchEndUs);
+        span(trace, "showBestMove+redraw", 4, trace.showStartUs, trace.redrawEndUs);
+        span(trace, "card", 0, trace.firstCaptureUs, trace.endUs());
+        fflush(file);
+    }
+
+    // p50/p95/p99 over the last kWindow cards, end to end and per stage, with
+    // the number of cards the stage ran for.
+    void printSummary(std::ostream &out) const {
+        if (recent.empty()) return;
+        out << "latency over last " << recent.size() << " of " << count << " cards (us, p50/p95/p99):";
+        summarise(out, "end-to-end", [](const CardTrace &t) { return std::make_pair(t.firstCaptureUs, t.endUs()); });
+        summarise(out, "capture", [](const CardTrace &t) { return std::make_pair(t.captureStartUs, t.captureEndUs); });
+        summarise(out, "convert", [](const CardTrace &t) { return std::make_pair(t.captureEndUs, t.convertEndUs); });
+        summarise(out, "confirm", [](const CardTrace &t) {
+            return t.confirmed ? std::make_pair(t.firstCaptureUs, t.captureStartUs) : std::make_pair<int64_t, int64_t>(0, 0);
+        });
+        summarise(out, "fromFrame", [](const CardTrace &t) { return std::make_pair(t.recogniseStartUs, t.recogniseEndUs); });
+        summarise(out, "queued", [](const CardTrace &t) { return std::make_pair(t.recogniseEndUs, t.deliveredUs); });
+        summarise(out, "search", [](const CardTrace &t) { return std::make_pair(t.searchStartUs, t.searchEndUs); });
+        summarise(out, "overlay", [](const CardTrace &t) { return std::make_pair(t.showStartUs, t.redrawEndUs); });
+        out << std::endl;
+    }
+
+    size_t cards() const { return count; }
+
+private:
+    // `stage` gives a trace's (begin, end); cards where the stage did not
+    // run are left out, as span() leaves them out of the file.
+    template <class Stage>
+    void summarise(std::ostream &out, const char *name, Stage stage) const {
+        std::vector<int64_t> values;
+        values.reserve(recent.size());
+        for (const CardTrace &trace : recent) {
+            const std::pair<int64_t, int64_t> times = stage(trace);
+            if (times.first <= 0 || times.second < times.first) continue;
+            values.push_back(times.second - times.first);
+        }
+        out << "\n  " << name << " ";
+        if (values.empty()) {
+            out << "-";
+            return;
+        }
+        std::sort(values.begin(), values.end());
+        auto at = [&](double p) { return values[std::min(values.size() - 1, (size_t)(p * values.size()))]; };
+        out << at(0.50) << "/" << at(0.95) << "/" << at(0.99) << " (" << values.size() << ")";
+    }
+
+    void span(const CardTrace &trace, const char *name, int tid, int64_t begin, int64_t end) {
+        if (begin <= 0 || end < begin) return;
+        fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,"
+                      "\"args\":{\"card\":%d,\"frame\":%llu}},\n",
+                name, tid, (long long)begin, (long long)(end - begin), trace.card,
+                (unsigned long long)trace.frame);
+    }
+
+    std::deque<CardTrace> recent;
+    size_t count = 0;
+    FILE *file = NULL;
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "pool.h"
+#include "state.h"
+#include "smart_weights.h"
+
+// Plays one game with the rollout policy alone and returns its score, scored
+// like an MCTS rollout (minus one point per five undos).
+static double playPolicyGame(uint64_t seed) {
+    State::seedRandom(seed);
+    State start;
+    State * state = start.sampleState();
+    while (!state->isTerminal()) {
+        if (!state->makeSmartMove()) {
+            break;
+        }
+        State * next = state->sampleState();
+        delete state;
+        state = next;
+    }
+    const double score = state->score - state->numUndo / 5;
+    delete state;
+    return score;
+}
+
+// Average policy score of `weights` over the games seeded `seeds`, played on
+// the thread pool.
+static double evalSmartMoveWeights(const SmartMoveWeights &weights, const std::vector<uint64_t> &seeds) {
+    const int numTasks = ThreadPool::global().size();
+    std::atomic<size_t> next(0);
+    std::vector<double> sums(numTasks, 0.0);
+    ThreadPool::Group group;
+    for (int t = 0; t < numTasks; t++) {
+        group.run([&, t]() {
+            const SmartMoveWeights *saved = SmartMoveWeights::active();
+            const uint64_t savedRandom = State::rngState;
+            SmartMoveWeights::active() = &weights;
+            size_t i;
+            while ((i = next.fetch_add(1)) < seeds.size()) {
+                sums[t] += playPolicyGame(seeds[i]);
+            }
+            SmartMoveWeights::active() = saved;
+            State::rngState = savedRandom;
+        });
+    }
+    group.wait();
+    double total = 0.0;
+    for (double sum : sums) total += sum;
+    return seeds.empty() ? 0.0 : total / (double)seeds.size();
+}
+
+// SPSA search over the makeSmartMove() weights. Each step evaluates a pair of
+// opposite random perturbations on the same game seeds (common random
+// numbers), so the score difference measures the weights rather than the
+// deal. Weights are searched relative to their starting values. The best set
+// seen on a fixed validation deal is written to `outPath`.
+static int tuneSmartMoveWeights(int iterations, int gamesPerSide, const std::string &outPath) {
+    size_t numFields = 0;
+    const SmartMoveWeights::Field *fields = SmartMoveWeights::fields(numFields);
+    const SmartMoveWeights start = SmartMoveWeights::defaults();
+
+    auto toWeights = [&](const std::vector<double> &u) {
+        SmartMoveWeights weights = start;
+        for (size_t i = 0; i < numFields; i++) {
+            weights.*fields[i].member = start.*fields[i].member * u[i];
+        }
+        return weights;
+    };
+
+    std::vector<uint64_t> validationSeeds(gamesPerSide * 4);
+    for (size_t i = 0; i < validationSeeds.size(); i++) {
+        validationSeeds[i] = 0xC0FFEEull + i;
+    }
+
+    std::vector<double> u(numFields, 1.0);
+    std::vector<double> bestU = u;
+    double bestScore = evalSmartMoveWeights(start, validationSeeds);
+    cout << "start: " << bestScore << " on " << validationSeeds.size() << " validation games" << endl;
+
+    // Standard SPSA gain sequences; `a` is calibrated from the first steps so
+    // that an average gradient moves each weight by about 5%.
+    const double c = 0.1;
+    const double alpha = 0.602;
+    const double gamma = 0.101;
+    const double stabilityA = iterations / 10.0;
+    const int calibrationSteps = min(5, iterations);
+    double a = 0.0;
+    double gradientScale = 0.0;
+
+    std::mt19937_64 rng(12345);
+    uint64_t seedBase = 1;
+    auto started = chrono::steady_clock::now();
+    for (int k = 0; k < iterations; k++) {
+        const double ck = c / pow(k + 1.0, gamma);
+        std::vector<double> delta(numFields);
+        std::vector<double> plus(numFields), minus(numFields);
+        for (size_t i = 0; i < numFields; i++) {
+            delta[i] = (rng() & 1) ? 1.0 : -1.0;
+            plus[i] = max(0.0, u[i] + ck * delta[i]);
+            minus[i] = max(0.0, u[i] - ck * delta[i]);
+        }
+
+        std::vector<uint64_t> seeds(gamesPerSide);
+        for (int g = 0; g < gamesPerSide; g++) {
+            seeds[g] = seedBase++;
+        }
+        const double fPlus = evalSmartMoveWeights(toWeights(plus), seeds);
+        const double fMinus = evalSmartMoveWeights(toWeights(minus), seeds);
+        const double diff = (fPlus - fMinus) / (2.0 * ck);
+
+        if (k < calibrationSteps) {
+            gradientScale += fabs(diff) / calibrationSteps;
+            if (k == calibrationSteps - 1) {
+                a = 0.05 * pow(stabilityA + 1.0, alpha) / max(gradientScale, 1e-9);
+            }
+            continue;
+        }
+
+        const double ak = a / pow(k + 1.0 + stabilityA, alpha);
+        for (size_t i = 0; i < numFields; i++) {
+            u[i] = min(3.0, max(0.0, u[i] + ak * diff * delta[i]));
+        }
+
+        if ((k + 1) % 10 == 0 || k == iterations - 1) {
+            const double score = evalSmartMoveWeights(toWeights(u), validationSeeds);
+            const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            cout << "iter " << (k + 1) << ": " << score << " (best " << max(score, bestScore) << ", "
+                 << elapsed << " s)" << endl;
+            if (score > bestScore) {
+                bestScore = score;
+                bestU = u;
+                toWeights(bestU).save(outPath);
+            }
+        }
+    }
+
+    const SmartMoveWeights best = toWeights(bestU);
+    if (!best.save(outPath)) {
+        cerr << "Failed to write weights to " << outPath << endl;
+        return 1;
+    }
+    cout << "best validation score " << bestScore << ", written to " << outPath << ":" << endl;
+    best.write(cout);
+    return 0;
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "state.h"
+
+// Linear estimate of the points a game will still make from a state under the
+// rollout policy, net of the undo penalty (score - numUndo / 5), as rollouts
+// count it. Used to finish truncated rollouts (--rollout-depth); trained with
+// --train-value from policy self-play and read back with --value.
+struct ValueFunction {
+    static constexpr int kNumFeatures = 30;
+
+    double weights[kNumFeatures] = {0.0};
+    bool loaded = false;
+
+    static const char *featureName(int i) {
+        static const char *kNames[kNumFeatures] = {
+            "bias", "cardsLeft", "streak", "hasBusted", "canUndo", "nextKnown",
+            "emptyPiles", "softPiles", "fourCardPiles",
+            "piles1to11", "piles12to15", "piles16to17", "piles18", "piles19", "piles20",
+            "clearShare", "clearCards", "curWild", "curValue",
+            "left0", "left1", "left2", "left3", "left4", "left5",
+            "left6", "left7", "left8", "left9", "left10",
+        };
+        return kNames[i];
+    }
+
+    static void features(const State &s, double out[kNumFeatures]) {
+        int emptyPiles = 0, softPiles = 0, fourCardPiles = 0;
+        int low = 0, mid = 0, high = 0, on18 = 0, on19 = 0, on20 = 0;
+        int clearing = 0; // remaining cards that would clear some pile, summed over piles
+        for (int i = 0; i < State::kPiles; i++) {
+            const int t = s.totals[i];
+            if (t == 0) emptyPiles++;
+            else if (t <= 11) low++;
+            else if (t <= 15) mid++;
+            else if (t <= 17) high++;
+            else if (t == 18) on18++;
+            else if (t == 19) on19++;
+            else if (t == 20) on20++;
+            if (s.soft[i]) softPiles++;
+            if (s.numCards[i] == GAME_RULES::kClearCards - 1) fourCardPiles++;
+            clearing += s.left[0];
+            if (21 - t >= 1 && 21 - t <= 10) clearing += s.left[21 - t];
+            if (s.soft[i] && 11 - t >= 1 && 11 - t <= 10) clearing += s.left[11 - t];
+        }
+        const double clearShare = (double)clearing / ((double)State::kPiles * max(1, s.cardsLeft));
+
+        int k = 0;
+        out[k++] = 1.0;
+        out[k++] = s.cardsLeft;
+        out[k++] = s.streak;
+        out[k++] = s.hasBusted;
+        out[k++] = s.canUndo;
+        out[k++] = s.nextCard != -1;
+        out[k++] = emptyPiles;
+        out[k++] = softPiles;
+        out[k++] = fourCardPiles;
+        out[k++] = low;
+        out[k++] = mid;
+        out[k++] = high;
+        out[k++] = on18;
+        out[k++] = on19;
+        out[k++] = on20;
+        out[k++] = clearShare;
+        out[k++] = clearShare * s.cardsLeft;
+        out[k++] = s.curCard == 0;
+        out[k++] = max(0, s.curCard);
+        for (int v = 0; v < 11; v++) {
+            out[k++] = s.left[v];
+        }
+    }
+
+    // Expected (score - numUndo / 5) still to come from `s`.
+    double remaining(const State &s) const {
+        double f[kNumFeatures];
+        features(s, f);
+        double sum = 0.0;
+        for (int i = 0; i < kNumFeatures; i++) sum += weights[i] * f[i];
+        return sum;
+    }
+
+    bool load(const std::string &path) {
+        std::ifstream in(path);
+        if (!in) return false;
+        std::string name;
+        double value;
+        while (in >> name >> value) {
+            bool found = false;
+            for (int i = 0; i < kNumFeatures; i++) {
+                if (name == featureName(i)) {
+                    weights[i] = value;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                std::cerr << "Unknown value feature '" << name << "' in " << path << std::endl;
+            }
+        }
+        loaded = true;
+        return true;
+    }
+
+    bool save(const std::string &path) const {
+        std::ofstream out(path);
+        if (!out) return false;
+        out.precision(10);
+        for (int i = 0; i < kNumFeatures; i++) {
+            out << featureName(i) << " " << weights[i] << "\n";
+        }
+        return (bool)out;
+    }
+
+    static ValueFunction &active() {
+        static ValueFunction value;
+        return value;
+    }
+};
+
+// Plays `games` policy-only games, records the features of every state the
+// rollout loop visits with the points still made from it, and fits the
+// weights by ridge regression. The last tenth of the games is held out to
+// report the fit.
+static int trainValueFunction(int games, const std::string &outPath) {
+    const int n = ValueFunction::kNumFeatures;
+    const int trainGames = max(1, games - games / 10);
+    std::vector<double> xtx(n * n, 0.0), xty(n, 0.0);
+    std::vector<std::vector<double>> heldOut;
+    std::vector<double> heldOutTargets;
+    long long samples = 0;
+
+    auto started = chrono::steady_clock::now();
+    for (int g = 0; g < games; g++) {
+        State::seedRandom(0x5EEDull + (uint64_t)g);
+        State start;
+        State * state = start.sampleState();
+        std::vector<std::vector<double>> rows;
+        std::vector<int> soFar;
+        while (!state->isTerminal()) {
+            std::vector<double> f(n);
+            ValueFunction::features(*state, f.data());
+            rows.push_back(f);
+            soFar.push_back(state->score - state->numUndo / 5);
+            if (!state->makeSmartMove()) {
+                break;
+            }
+            State * next = state->sampleState();
+            delete state;
+            state = next;
+        }
+        const int final = state->score - state->numUndo / 5;
+        delete state;
+
+        for (size_t r = 0; r < rows.size(); r++) {
+            const double target = final - soFar[r];
+            if (g < trainGames) {
+                for (int i = 0; i < n; i++) {
+                    xty[i] += rows[r][i] * target;
+                    for (int j = 0; j < n; j++) xtx[i * n + j] += rows[r][i] * rows[r][j];
+                }
+                samples++;
+            } else {
+                heldOut.push_back(rows[r]);
+                heldOutTargets.push_back(target);
+            }
+        }
+    }
+
+    // Solve (X'X + lambda I) w = X'y by Gaussian elimination with partial pivoting.
+    const double lambda = 1e-3 * (double)max(1LL, samples);
+    for (int i = 1; i < n; i++) xtx[i * n + i] += lambda;
+    std::vector<double> w = xty;
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        for (int r = col + 1; r < n; r++) {
+            if (fabs(xtx[r * n + col]) > fabs(xtx[pivot * n + col])) pivot = r;
+        }
+        if (fabs(xtx[pivot * n + col]) < 1e-12) {
+            cerr << "Value fit is singular at feature " << ValueFunction::featureName(col) << endl;
+            return 1;
+        }
+        if (pivot != col) {
+            for (int j = 0; j < n; j++) swap(xtx[col * n + j], xtx[pivot * n + j]);
+            swap(w[col], w[pivot]);
+        }
+        for (int r = 0; r < n; r++) {
+            if (r == col) continue;
+            const double factor = xtx[r * n + col] / xtx[col * n + col];
+            if (factor == 0.0) continue;
+            for (int j = col; j < n; j++) xtx[r * n + j] -= factor * xtx[col * n + j];
+            w[r] -= factor * w[col];
+        }
+    }
+    ValueFunction value;
+    for (int i = 0; i < n; i++) value.weights[i] = w[i] / xtx[i * n + i];
+
+    double sq = 0.0, sqMean = 0.0, mean = 0.0;
+    for (double t : heldOutTargets) mean += t;
+    if (!heldOutTargets.empty()) mean /= (double)heldOutTargets.size();
+    for (size_t r = 0; r < heldOut.size(); r++) {
+        double predicted = 0.0;
+        for (int i = 0; i < n; i++) predicted += value.weights[i] * heldOut[r][i];
+        sq += (predicted - heldOutTargets[r]) * (predicted - heldOutTargets[r]);
+        sqMean += (mean - heldOutTargets[r]) * (mean - heldOutTargets[r]);
+    }
+    const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    cout << samples << " training states from " << trainGames << " games (" << elapsed << " s)" << endl;
+    if (!heldOut.empty()) {
+        cout << "held-out RMSE " << sqrt(sq / (double)heldOut.size())
+             << " (constant baseline " << sqrt(sqMean / (double)heldOut.size()) << ")"
+             << " on " << heldOut.size() << " states" << endl;
+    }
+    if (!value.save(outPath)) {
+        cerr << "Failed to write value weights to " << outPath << endl;
+        return 1;
+    }
+    cout << "written to " << outPath << endl;
+    return 0;
+}